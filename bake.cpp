@@ -0,0 +1,219 @@
+// 环境光遮蔽烘焙：在模型的 UV 布局上逐纹素计算遮蔽，写出 <name>_ao.tga，Model 加载时与 _spec.tga 一样自动读入，
+// 渲染时遮蔽只是一次纹理采样
+//   tinyrenderer_bake [--size 512] [--views 128] [--resolution 512] [--threads n] [-o file] model.obj
+// 从球面上均匀分布的 views 个方向各画一张正交深度图（与阴影贴图相同），纹素对每个方向按 cos 加权统计是否可见；
+// 各方向的深度图在线程池里并行绘制和查询
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <mutex>
+#include "gl.h"
+#include "model.h"
+#include "jobs.h"
+
+namespace {
+
+struct Options {
+    int size       = 512;               // 输出贴图的边长
+    int views      = 128;               // 采样方向数
+    int resolution = 512;               // 每张深度图的边长
+    int threads    = 0;
+    std::string output;                 // 为空时为 <name>_ao.tga
+};
+
+// 被 UV 覆盖的纹素：下标 y*size + x，模型坐标的位置和单位法线
+struct Texel {
+    int index;
+    Vec3f pos, normal;
+};
+
+// 按纹素中心光栅化每个三角面的 UV，插值位置和法线；UV 重叠时后画的面覆盖先画的
+std::vector<Texel> rasterize_uvs(Model &model, int size) {
+    PROFILE_SCOPE("ao_texels");
+    std::vector<int> slot(size_t(size)*size, -1);
+    std::vector<Texel> texels;
+    for (int f=0; f<model.nfaces(); f++) {
+        Vec2f uv[3];
+        for (int j=0; j<3; j++) uv[j] = Vec2f(model.uv(f, j).x*size, model.uv(f, j).y*size);
+        float e1x = uv[1].x - uv[0].x, e1y = uv[1].y - uv[0].y;
+        float e2x = uv[2].x - uv[0].x, e2y = uv[2].y - uv[0].y;
+        float area = e1x*e2y - e2x*e1y;
+        if (std::abs(area) < 1e-12f) continue;
+        int xmin = std::max(0,      (int)std::floor(std::min({uv[0].x, uv[1].x, uv[2].x})));
+        int ymin = std::max(0,      (int)std::floor(std::min({uv[0].y, uv[1].y, uv[2].y})));
+        int xmax = std::min(size-1, (int)std::ceil (std::max({uv[0].x, uv[1].x, uv[2].x})));
+        int ymax = std::min(size-1, (int)std::ceil (std::max({uv[0].y, uv[1].y, uv[2].y})));
+        for (int y=ymin; y<=ymax; y++) {
+            for (int x=xmin; x<=xmax; x++) {
+                // 纹素 x 覆盖 [x, x+1)，与最近点采样的 int(u*size) 一致
+                float px = x + .5f - uv[0].x, py = y + .5f - uv[0].y;
+                float l1 = (px*e2y - py*e2x)/area, l2 = (py*e1x - px*e1y)/area, l0 = 1 - l1 - l2;
+                if (l0 < -EDGE_EPS || l1 < -EDGE_EPS || l2 < -EDGE_EPS) continue;
+                Texel t;
+                t.index = y*size + x;
+                t.pos = model.vert(f, 0)*l0 + model.vert(f, 1)*l1 + model.vert(f, 2)*l2;
+                t.normal = normalized(model.normal(f, 0)*l0 + model.normal(f, 1)*l1 + model.normal(f, 2)*l2);
+                int &s = slot[t.index];
+                if (s < 0) {
+                    s = texels.size();
+                    texels.push_back(t);
+                } else {
+                    texels[s] = t;
+                }
+            }
+        }
+    }
+    return texels;
+}
+
+// 球面上的斐波那契点集，方向近似均匀分布
+Vec3f sphere_direction(int i, int n) {
+    const float golden = 2.39996323f;                   // pi*(3 - sqrt(5))
+    float z = 1 - (2*i + 1.f)/n, r = std::sqrt(std::max(0.f, 1 - z*z));
+    return Vec3f(r*std::cos(golden*i), r*std::sin(golden*i), z);
+}
+
+// 沿 dir 看向包围球的正交深度图变换：z 沿 dir 增大（越大越近），包围球映射到整张深度图
+// 不用 lookat()：它的基不是正交的，见 gl.h
+mat<4,4,float> view_transform(Vec3f dir, Vec3f center, float radius, int resolution) {
+    Vec3f z = dir;
+    Vec3f x = normalized(cross(std::abs(z.y) < .9f ? Vec3f(0,1,0) : Vec3f(1,0,0), z));
+    Vec3f y = cross(z, x);
+    float k = 1.f/radius;
+    mat<4,4,float> view = {{{x.x*k, x.y*k, x.z*k, -(x*center)*k}, {y.x*k, y.y*k, y.z*k, -(y*center)*k},
+                            {z.x*k, z.y*k, z.z*k, -(z*center)*k}, {0,0,0,1}}};
+    return viewport(0, 0, resolution, resolution)*view;
+}
+
+// 每个方向画一张深度图，统计 sum(cos*可见) 和 sum(cos)
+void accumulate_views(Model &model, const std::vector<Texel> &texels, const Options &opt, std::vector<float> &visible, std::vector<float> &weight) {
+    PROFILE_SCOPE("ao_views");
+    const Vec3f center = model.center();
+    const float radius = model.radius()*1.01f;
+    // 深度偏移和沿法线的偏移都约为深度图的 1.5 个像素，抑制自遮挡条纹
+    const float texel_world = 2*radius/opt.resolution;
+    const float bias = 1.5f*texel_world/radius;
+    std::mutex mutex;
+    visible.assign(texels.size(), 0.f);
+    weight.assign(texels.size(), 0.f);
+    jobs::parallel_for(0, opt.views, 1, [&](int begin, int end) {
+        std::vector<float> vis(texels.size(), 0.f), w(texels.size(), 0.f);
+        ShadowMap map(opt.resolution, opt.resolution);
+        for (int v=begin; v<end; v++) {
+            Vec3f dir = sphere_direction(v, opt.views);
+            map.clear();
+            map.transform = view_transform(dir, center, radius, opt.resolution);
+            for (int f=0; f<model.nfaces(); f++) {
+                Vec3f verts[3];
+                for (int j=0; j<3; j++) verts[j] = model.vert(f, j);
+                map.draw(verts);
+            }
+            for (size_t t=0; t<texels.size(); t++) {
+                float c = texels[t].normal*dir;
+                if (c <= 0) continue;
+                w[t] += c;
+                vis[t] += c*map.lit(texels[t].pos + texels[t].normal*(1.5f*texel_world), bias);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t t=0; t<texels.size(); t++) {
+            visible[t] += vis[t];
+            weight[t] += w[t];
+        }
+    });
+}
+
+// 把有值的纹素向外扩几圈，避免 UV 岛边缘的最近点采样取到岛外的空白
+void dilate(std::vector<float> &ao, std::vector<bool> &covered, int size, int passes) {
+    for (int p=0; p<passes; p++) {
+        std::vector<float> next = ao;
+        std::vector<bool> grown = covered;
+        for (int y=0; y<size; y++) {
+            for (int x=0; x<size; x++) {
+                if (covered[y*size + x]) continue;
+                float sum = 0;
+                int n = 0;
+                for (int dy=-1; dy<=1; dy++)
+                    for (int dx=-1; dx<=1; dx++) {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx<0 || ny<0 || nx>=size || ny>=size || !covered[ny*size + nx]) continue;
+                        sum += ao[ny*size + nx];
+                        n++;
+                    }
+                if (n) {
+                    next[y*size + x] = sum/n;
+                    grown[y*size + x] = true;
+                }
+            }
+        }
+        ao.swap(next);
+        covered.swap(grown);
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    const char *filename = NULL;
+    for (int i=1; i<argc; i++) {
+        if      (!strcmp(argv[i], "--size")       && i+1<argc) opt.size = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--views")      && i+1<argc) opt.views = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--resolution") && i+1<argc) opt.resolution = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads")    && i+1<argc) opt.threads = std::atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o")           && i+1<argc) opt.output = argv[++i];
+        else if (argv[i][0]=='-') {
+            std::cerr << "unknown option " << argv[i] << std::endl;
+            return 2;
+        }
+        else filename = argv[i];
+    }
+    if (!filename || opt.size <= 0 || opt.views <= 0 || opt.resolution <= 0) {
+        std::cerr << "usage: tinyrenderer_bake [--size 512] [--views 128] [--resolution 512] [--threads n] [-o file] model.obj" << std::endl;
+        return 2;
+    }
+    if (opt.output.empty()) {
+        std::string name(filename);
+        opt.output = name.substr(0, name.find_last_of(".")) + "_ao.tga";
+    }
+    jobs::Options pool;
+    pool.threads = opt.threads;
+    jobs::init(pool);
+
+    // 只需要网格；不做顶点缓存优化以外的处理，也不加载贴图
+    ModelOptions options;
+    options.textures = TextureLoad::Lazy;
+    Model model(filename, options);
+    if (!model.nfaces()) {
+        std::cerr << "can't load " << filename << std::endl;
+        return 1;
+    }
+
+    std::int64_t t0 = profiler::now();
+    std::vector<Texel> texels = rasterize_uvs(model, opt.size);
+    std::vector<float> visible, weight;
+    accumulate_views(model, texels, opt, visible, weight);
+
+    // 没有被 UV 覆盖的纹素取 1（不遮挡），之后由扩边覆盖岛的边缘
+    std::vector<float> ao(size_t(opt.size)*opt.size, 1.f);
+    std::vector<bool> covered(ao.size(), false);
+    for (size_t t=0; t<texels.size(); t++) {
+        ao[texels[t].index] = weight[t] > 0 ? visible[t]/weight[t] : 1.f;
+        covered[texels[t].index] = true;
+    }
+    dilate(ao, covered, opt.size, 4);
+
+    // 内存中第 y 行对应 v = y/size，与 TextureCache 读入并翻转后的朝向相同；write_tga_file 默认以左下角为原点写出，读回时正好还原
+    TGAImage img(opt.size, opt.size, TGAImage::GRAYSCALE);
+    for (int y=0; y<opt.size; y++)
+        for (int x=0; x<opt.size; x++)
+            img.set(x, y, TGAColor{std::uint8_t(std::clamp(ao[y*opt.size + x], 0.f, 1.f)*255.f + .5f)});
+    if (!img.write_tga_file(opt.output)) {
+        std::cerr << "can't write " << opt.output << std::endl;
+        return 1;
+    }
+    std::cerr << opt.output << ": " << texels.size() << " texels, " << opt.views << " views, "
+              << (profiler::now() - t0)/1000000 << " ms, " << jobs::nthreads() + 1 << " threads" << std::endl;
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <cmath>
+#include "bands.h"
+#include "model.h"
+#include "jobs.h"
+
+BinnedGeometry::BinnedGeometry(int height, int band_rows) : height(height), band_rows(std::max(1, band_rows)) {}
+
+void BinnedGeometry::add(const Vec4f *clip, const Vec2f *uvs, const IShader &shader) {
+    if (nvaryings < 0) nvaryings = shader.nvaryings;
+
+    // 与 triangle() 的包围盒相同；顶点在相机平面上或后面时投影不可靠，保守地放进所有带
+    int lo = 0, hi = nbands() - 1;
+    if (clip[0].w > 0 && clip[1].w > 0 && clip[2].w > 0) {
+        float y[3];
+        for (int i=0; i<3; i++) y[i] = clip[i].y/clip[i].w;
+        float fmin = std::floor(std::min({y[0], y[1], y[2]})), fmax = std::ceil(std::max({y[0], y[1], y[2]}));
+        if (!(fmax >= 0 && fmin < height)) return;          // 完全在图像上下方（或出现 NaN）
+        lo = std::max(0, int(fmin))/band_rows;
+        hi = std::min(height - 1, int(fmax))/band_rows;
+    }
+    ymin.push_back(lo);
+    ymax.push_back(hi);
+    for (int i=0; i<3; i++) {
+        for (int k=0; k<4; k++) attribs.push_back(clip[i][k]);
+        attribs.push_back(uvs[i].x);
+        attribs.push_back(uvs[i].y);
+        for (int k=0; k<nvaryings; k++) attribs.push_back(shader.varying[i][k]);
+    }
+}
+
+void BinnedGeometry::add_model(Model &model, IShader &shader) {
+    const bool timed = PROFILE_ENABLED();
+    std::int64_t t0 = timed ? profiler::now() : 0;
+    shader.prepare();
+    for (int i=0; i<model.nfaces(); i++) {
+        Vec4f clip_coords[3];
+        Vec2f uvs[3];
+        shader.iface = i;
+        for (int j=0; j<3; j++) {
+            clip_coords[j] = shader.vertex(model.vert(i, j), model.normal(i, j), j);
+            uvs[j] = model.uv(i, j);
+        }
+        add(clip_coords, uvs, shader);
+    }
+    if (timed) {
+        profiler::add_time("vertex", profiler::now() - t0);
+        profiler::count("triangles", model.nfaces());
+    }
+}
+
+void BinnedGeometry::finish() {
+    // 计数排序：先数每条带的三角形个数，再按前缀和填入
+    int n = nbands();
+    offsets.assign(n + 1, 0);
+    for (size_t t=0; t<ymin.size(); t++)
+        for (int b=ymin[t]; b<=ymax[t]; b++) offsets[b+1]++;
+    for (int b=0; b<n; b++) offsets[b+1] += offsets[b];
+    tris.resize(offsets[n]);
+    std::vector<int> fill(offsets.begin(), offsets.end()-1);
+    for (size_t t=0; t<ymin.size(); t++)
+        for (int b=ymin[t]; b<=ymax[t]; b++) tris[fill[b]++] = t;
+}
+
+void BinnedGeometry::draw_band(int band, IShader &shader, TGAImage &image, float *zbuffer) const {
+    const float y0 = band_y(band);
+    for (int i=offsets[band]; i<offsets[band+1]; i++) {
+        const float *a = attribs.data() + size_t(tris[i])*stride();
+        Vec4f clip[3];
+        Vec2f uvs[3];
+        for (int j=0; j<3; j++) {
+            // 屏幕坐标整体上移 y0 行：y/w - y0 = (y - y0*w)/w，透视校正插值不受影响
+            clip[j] = Vec4f(a[0], a[1] - y0*a[3], a[2], a[3]);
+            uvs[j] = Vec2f(a[4], a[5]);
+            for (int k=0; k<nvaryings; k++) shader.varying[j][k] = a[6+k];
+            a += 6 + nvaryings;
+        }
+        triangle(clip, uvs, shader, image, zbuffer);
+    }
+}
+
+int band_rows_for(int width, int bpp, size_t memory_budget) {
+    size_t row = size_t(width)*(2*bpp + sizeof(float));
+    size_t rows = memory_budget/std::max<size_t>(row, 1);
+    return int(std::max<size_t>(4, std::min<size_t>(rows, 1<<20)) & ~size_t(3));
+}
+
+bool render_banded(Model &model, IShader &shader, int width, int height, const std::string &filename, size_t memory_budget, int bpp) {
+    BinnedGeometry geometry(height, band_rows_for(width, bpp, memory_budget));
+    {
+        PROFILE_SCOPE("bin");
+        geometry.add_model(model, shader);
+        geometry.finish();
+    }
+
+    TiledTGAWriter out;
+    if (!out.open(filename, width, height, bpp)) return false;
+    const RateImage *rates = shader.rates;
+    shader.rates = NULL;
+    // 颜色缓冲双缓冲：上一条带在线程池里编码的同时光栅化这一条带
+    bool ok = true;
+    TGAImage images[2];
+    std::vector<float> zbuffer;
+    std::shared_future<bool> written;
+    for (int b=0; ok && b<geometry.nbands(); b++) {
+        PROFILE_SCOPE("band");
+        int rows = geometry.band_height(b);
+        TGAImage &image = images[b%2];                      // 上上条带的编码已在上一轮等完
+        image = TGAImage(width, rows, bpp);
+        zbuffer.assign(size_t(width)*rows, -std::numeric_limits<float>::max());
+        geometry.draw_band(b, shader, image, zbuffer.data());
+        if (written.valid()) ok = jobs::wait(written);
+        written = jobs::async([&out, &image, rows] { return out.write_rows(image.buffer(), rows, size_t(image.width())*image.bytespp()); });
+    }
+    if (written.valid()) ok = jobs::wait(written) && ok;
+    shader.rates = rates;
+    return out.close() && ok;
+}
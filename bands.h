@@ -0,0 +1,54 @@
+#ifndef __BANDS_H__
+#define __BANDS_H__
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "gl.h"
+
+class Model;
+
+// 分带离屏渲染：整幅图像按水平带逐条光栅化，每条带只有自己的颜色和深度缓冲，画完立即流式写出，
+// 内存与带的大小成正比而不是与图像大小成正比，用于远超内存的打印分辨率（如 32k x 32k）
+
+// 顶点阶段的输出：每个三角形只做一次顶点着色，按覆盖的屏幕行分箱，之后每条带复用
+class BinnedGeometry {
+public:
+    // height 为整幅图像的高度，band_rows 为每条带的行数
+    BinnedGeometry(int height, int band_rows);
+
+    // 收集一个三角形：clip 为顶点着色器的输出，varying 取自 shader.varying
+    void add(const Vec4f *clip, const Vec2f *uvs, const IShader &shader);
+    // 模型的所有面依次经过顶点着色器后收集，与 draw_faces 相同
+    void add_model(Model &model, IShader &shader);
+    // 收集完毕后建立分箱
+    void finish();
+
+    int nbands() const { return (height + band_rows - 1)/band_rows; }
+    int band_y(int band) const { return band*band_rows; }
+    int band_height(int band) const { return std::min(band_rows, height - band*band_rows); }
+    size_t ntriangles() const { return ymin.size(); }
+
+    // 把一条带内的三角形画进 image/zbuffer，二者只有 band_height(band) 行；image 的第 0 行对应整幅图像的 band_y(band) 行
+    void draw_band(int band, IShader &shader, TGAImage &image, float *zbuffer) const;
+
+private:
+    int height, band_rows;
+    int nvaryings = -1;
+    std::vector<float> attribs;         // 每个三角形 3 x (clip 4 + uv 2 + nvaryings) 个浮点数
+    std::vector<int>   ymin, ymax;      // 三角形覆盖的带号范围
+    std::vector<int>   offsets, tris;   // 分箱：第 b 条带的三角形为 tris[offsets[b], offsets[b+1])
+
+    int stride() const { return 3*(6 + nvaryings); }
+};
+
+// 按 memory_budget 选带高：两份颜色缓冲（光栅化与上一条带的编码重叠）加一份深度，每行 width*(2*bpp+4) 字节，
+// 至少 4 行并按 4 对齐（粗粒度着色块不跨带）
+int band_rows_for(int width, int bpp, size_t memory_budget);
+
+// 渲染 model 并写出到 filename，超出 TGA 尺寸上限时按 TiledTGAWriter 切成多个文件
+// shader 须已按 width x height 的视口绑定好相机；逐块着色率图 shader.rates 是整幅图像坐标，分带时不使用
+// 输出以左上角为原点，与 flip_vertically 后 write_tga_file 的结果显示方向相同
+bool render_banded(Model &model, IShader &shader, int width, int height, const std::string &filename,
+                   size_t memory_budget, int bpp = TGAImage::RGB);
+
+#endif //__BANDS_H__
@@ -0,0 +1,217 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+#include "blocktex.h"
+#include "geometrylix.h"
+#include "profiler.h"
+
+namespace {
+
+const char MAGIC[4] = {'T','R','B','C'};
+
+Vec3f expand565(std::uint16_t c) {
+    int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    return Vec3f((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+std::uint16_t pack565(Vec3f c) {
+    auto q = [](float v, int max) { return std::clamp(int(std::lround(v*max/255.f)), 0, max); };
+    return (q(c.x, 31) << 11) | (q(c.y, 63) << 5) | q(c.z, 31);
+}
+
+// 一块 16 个 RGB 纹素 -> 8 字节
+void encode_bc1(const Vec3f *texels, std::uint8_t *out) {
+    // 端点取主轴方向上投影最远的两个纹素
+    Vec3f mean(0,0,0);
+    for (int i=0; i<16; i++) mean = mean + texels[i];
+    mean = mean*(1.f/16);
+    float cov[3][3] = {};
+    for (int i=0; i<16; i++) {
+        Vec3f d = texels[i] - mean;
+        for (int a=0; a<3; a++)
+            for (int b=0; b<3; b++) cov[a][b] += d[a]*d[b];
+    }
+    Vec3f axis(1,1,1);
+    for (int it=0; it<8; it++) {                            // 幂迭代求协方差矩阵的主特征向量
+        Vec3f next(cov[0][0]*axis.x + cov[0][1]*axis.y + cov[0][2]*axis.z,
+                   cov[1][0]*axis.x + cov[1][1]*axis.y + cov[1][2]*axis.z,
+                   cov[2][0]*axis.x + cov[2][1]*axis.y + cov[2][2]*axis.z);
+        float len = norm(next);
+        if (len < 1e-6f) break;                             // 纯色块，任意方向都可以
+        axis = next*(1.f/len);
+    }
+    int imin = 0, imax = 0;
+    float pmin = axis*texels[0], pmax = pmin;
+    for (int i=1; i<16; i++) {
+        float p = axis*texels[i];
+        if (p < pmin) { pmin = p; imin = i; }
+        if (p > pmax) { pmax = p; imax = i; }
+    }
+    std::uint16_t c0 = pack565(texels[imax]), c1 = pack565(texels[imin]);
+    if (c0 < c1) std::swap(c0, c1);                         // c0 > c1 时为四色模式
+
+    std::uint32_t indices = 0;
+    if (c0 != c1) {
+        Vec3f p0 = expand565(c0), p1 = expand565(c1);
+        Vec3f palette[4] = {p0, p1, (p0*2 + p1)*(1.f/3), (p0 + p1*2)*(1.f/3)};
+        for (int i=0; i<16; i++) {
+            int best = 0;
+            float dbest = 1e30f;
+            for (int k=0; k<4; k++) {
+                Vec3f d = texels[i] - palette[k];
+                if (d*d < dbest) { dbest = d*d; best = k; }
+            }
+            indices |= std::uint32_t(best) << (2*i);
+        }
+    }
+    out[0] = c0 & 255; out[1] = c0 >> 8;
+    out[2] = c1 & 255; out[3] = c1 >> 8;
+    for (int i=0; i<4; i++) out[4+i] = (indices >> (8*i)) & 255;
+}
+
+// 一块 16 个单通道值 -> 8 字节
+void encode_bc4(const std::uint8_t *values, std::uint8_t *out) {
+    std::uint8_t a0 = *std::max_element(values, values+16), a1 = *std::min_element(values, values+16);
+    std::uint64_t indices = 0;
+    if (a0 != a1) {                                         // a0 > a1：端点之间 6 个插值
+        float palette[8] = {float(a0), float(a1)};
+        for (int k=2; k<8; k++) palette[k] = ((8-k)*a0 + (k-1)*a1)/7.f;
+        for (int i=0; i<16; i++) {
+            int best = 0;
+            for (int k=1; k<8; k++)
+                if (std::abs(values[i] - palette[k]) < std::abs(values[i] - palette[best])) best = k;
+            indices |= std::uint64_t(best) << (3*i);
+        }
+    }
+    out[0] = a0;
+    out[1] = a1;
+    for (int i=0; i<6; i++) out[2+i] = (indices >> (8*i)) & 255;
+}
+
+TGAColor decode_bc1(const std::uint8_t *block, int i) {
+    std::uint16_t c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+    int idx = (block[4 + i/4] >> (2*(i%4))) & 3;
+    Vec3f p0 = expand565(c0), p1 = expand565(c1), c;
+    if (c0 > c1) {
+        Vec3f palette[4] = {p0, p1, (p0*2 + p1)*(1.f/3), (p0 + p1*2)*(1.f/3)};
+        c = palette[idx];
+    } else {
+        Vec3f palette[4] = {p0, p1, (p0 + p1)*.5f, Vec3f(0,0,0)};
+        c = palette[idx];
+    }
+    return {std::uint8_t(c.z + .5f), std::uint8_t(c.y + .5f), std::uint8_t(c.x + .5f), 255, 3};
+}
+
+std::uint8_t decode_bc4(const std::uint8_t *block, int i) {
+    int a0 = block[0], a1 = block[1];
+    int bit = 3*i, byte = 2 + bit/8;
+    int idx = ((block[byte] | (byte+1 < 8 ? block[byte+1] << 8 : 0)) >> (bit%8)) & 7;
+    if (idx==0) return a0;
+    if (idx==1) return a1;
+    if (a0 > a1) return ((8-idx)*a0 + (idx-1)*a1 + 3)/7;
+    if (idx==6) return 0;
+    if (idx==7) return 255;
+    return ((6-idx)*a0 + (idx-1)*a1 + 2)/5;
+}
+
+}
+
+BlockTexture::BlockTexture(const TGAImage &img, BlockFormat format) : w(img.width()), h(img.height()), fmt(format) {
+    int bw = (w+3)/4, bh = (h+3)/4;
+    blocks.resize(size_t(bw)*bh*block_bytes());
+    for (int by=0; by<bh; by++) {
+        for (int bx=0; bx<bw; bx++) {
+            Vec3f rgb[16];
+            std::uint8_t r[16], g[16], gray[16];
+            for (int i=0; i<16; i++) {
+                // 右/下边缘不足 4 个纹素的块重复最后一行/列
+                TGAColor c = img.get(std::min(bx*4 + i%4, w-1), std::min(by*4 + i/4, h-1));
+                rgb[i]  = Vec3f(c[2], c[1], c[0]);
+                r[i]    = c[2];
+                g[i]    = c[1];
+                gray[i] = c[0];
+            }
+            std::uint8_t *out = blocks.data() + (size_t(by)*bw + bx)*block_bytes();
+            switch (fmt) {
+                case BlockFormat::BC1: encode_bc1(rgb, out); break;
+                case BlockFormat::BC4: encode_bc4(gray, out); break;
+                case BlockFormat::BC5: encode_bc4(r, out); encode_bc4(g, out+8); break;
+            }
+        }
+    }
+}
+
+TGAColor BlockTexture::get(int x, int y) const {
+    if (blocks.empty() || x<0 || y<0 || x>=w || y>=h) return {};
+    const std::uint8_t *block = blocks.data() + (size_t(y/4)*((w+3)/4) + x/4)*block_bytes();
+    int i = (y%4)*4 + x%4;
+    switch (fmt) {
+        case BlockFormat::BC1:
+            return decode_bc1(block, i);
+        case BlockFormat::BC4:
+            return {decode_bc4(block, i), 0, 0, 0, 1};
+        case BlockFormat::BC5: {
+            std::uint8_t r = decode_bc4(block, i), g = decode_bc4(block+8, i);
+            float nx = r/255.f*2 - 1, ny = g/255.f*2 - 1;
+            float nz = std::sqrt(std::max(0.f, 1 - nx*nx - ny*ny));
+            return {std::uint8_t((nz + 1)*.5f*255 + .5f), g, r, 255, 3};
+        }
+    }
+    return {};
+}
+
+bool BlockTexture::read(const std::string &filename, BlockFormat format) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[4];
+    std::uint8_t f;
+    std::uint32_t size[2];
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char *>(&f), 1);
+    in.read(reinterpret_cast<char *>(size), sizeof(size));
+    if (!in || std::memcmp(magic, MAGIC, 4) || f != std::uint8_t(format) || !size[0] || !size[1]) return false;
+    w = size[0];
+    h = size[1];
+    fmt = format;
+    blocks.resize(size_t((w+3)/4)*((h+3)/4)*block_bytes());
+    in.read(reinterpret_cast<char *>(blocks.data()), blocks.size());
+    if (!in) {
+        blocks.clear();
+        return false;
+    }
+    return true;
+}
+
+bool BlockTexture::write(const std::string &filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    std::uint8_t f = std::uint8_t(fmt);
+    std::uint32_t size[2] = {std::uint32_t(w), std::uint32_t(h)};
+    out.write(MAGIC, 4);
+    out.write(reinterpret_cast<const char *>(&f), 1);
+    out.write(reinterpret_cast<const char *>(size), sizeof(size));
+    out.write(reinterpret_cast<const char *>(blocks.data()), blocks.size());
+    return out.good();
+}
+
+bool load_block_texture(const std::string &path, BlockFormat format, BlockTexture &tex) {
+    static const char *ext[] = {".bc1", ".bc4", ".bc5"};
+    std::string cachefile = path + ext[int(format)];
+    std::error_code ec;
+    std::filesystem::file_time_type src = std::filesystem::last_write_time(path, ec);
+    if (ec) return false;
+    std::filesystem::file_time_type cached = std::filesystem::last_write_time(cachefile, ec);
+    if (!ec && cached >= src && tex.read(cachefile, format)) return true;
+
+    PROFILE_SCOPE("texture_compress");
+    TGAImage img;
+    if (!img.read_tga_file(path)) return false;
+    img.flip_vertically();
+    tex = BlockTexture(img, format);
+    // 先写临时文件再改名，并发的进程不会读到写了一半的缓存
+    std::string tmp = cachefile + "." + std::to_string(getpid());
+    if (tex.write(tmp)) std::filesystem::rename(tmp, cachefile, ec);
+    else std::filesystem::remove(tmp, ec);
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef __BLOCKTEX_H__
+#define __BLOCKTEX_H__
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "tgaimage.h"
+
+// 4x4 块压缩格式，与 GPU 的 BC1/BC4/BC5 布局一致：
+// BC1  8 字节/块，两个 RGB565 端点 + 2 位索引，用于颜色贴图（24 位 RGB 的 1/6）
+// BC4  8 字节/块，两个 8 位端点 + 3 位索引，单通道，用于高光贴图
+// BC5  16 字节/块，两个 BC4 通道存 x、y，z 由单位长度重建，只适用于切线空间法线贴图
+enum class BlockFormat { BC1, BC4, BC5 };
+
+class BlockTexture {
+public:
+    BlockTexture() = default;
+    BlockTexture(const TGAImage &img, BlockFormat format);     // 编码
+
+    // 磁盘缓存：头部记录格式和尺寸，读到的格式不符时返回 false
+    bool read(const std::string &filename, BlockFormat format);
+    bool write(const std::string &filename) const;
+
+    int width() const { return w; }
+    int height() const { return h; }
+    BlockFormat format() const { return fmt; }
+    size_t bytes() const { return blocks.size(); }
+
+    // 解码单个纹素，返回与 TGAImage::get 相同的通道约定：BC1 为 BGR，BC4 为灰度（bytespp 1），
+    // BC5 的 R、G 为 x、y，B 为重建的 z；越界时返回全 0
+    TGAColor get(int x, int y) const;
+
+private:
+    int w = 0, h = 0;
+    BlockFormat fmt = BlockFormat::BC1;
+    std::vector<std::uint8_t> blocks;
+
+    int block_bytes() const { return fmt==BlockFormat::BC5 ? 16 : 8; }
+};
+
+// 读取 TGA 贴图的压缩版本：优先用 <path>.bc1/.bc4/.bc5 缓存（比源文件新才算有效），否则读 TGA、按纹理坐标朝向翻转、编码并写回缓存
+// 源文件不存在或解码失败时返回 false
+bool load_block_texture(const std::string &path, BlockFormat format, BlockTexture &tex);
+
+#endif //__BLOCKTEX_H__
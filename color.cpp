@@ -0,0 +1,39 @@
+#include "color.h"
+
+#if defined(TINYRENDERER_SIMD) && defined(__SSE2__)
+#define COLOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef COLOR_SSE2
+
+namespace {
+
+// 4 个像素展开成两组 16 位通道，每组 2 个像素；乘积不超过 255*256，16 位乘法的低半部分就是精确值
+inline __m128i load4(const std::uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+inline void store4(std::uint32_t *p, __m128i v) { _mm_storeu_si128((__m128i *)p, v); }
+
+}
+
+void color_scale_n(const std::uint32_t *c, const std::uint16_t *k, std::uint32_t *out, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i+4<=n; i+=4) {
+        // 4 个系数各铺满对应像素的 4 个通道
+        __m128i kk = _mm_loadl_epi64((const __m128i *)(k + i));
+        kk = _mm_unpacklo_epi16(kk, kk);
+        __m128i v = load4(c + i);
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpacklo_epi32(kk, kk)), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), _mm_unpackhi_epi32(kk, kk)), 8);
+        store4(out + i, _mm_packus_epi16(lo, hi));
+    }
+    for (; i<n; i++) out[i] = color_scale(c[i], k[i]);
+}
+
+#else
+
+void color_scale_n(const std::uint32_t *c, const std::uint16_t *k, std::uint32_t *out, size_t n) {
+    for (size_t i=0; i<n; i++) out[i] = color_scale(c[i], k[i]);
+}
+
+#endif
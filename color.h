@@ -0,0 +1,24 @@
+#ifndef __COLOR_H__
+#define __COLOR_H__
+#include <cstddef>
+#include <cstdint>
+
+// 打包颜色的定点运算。颜色是一个 32 位字 b | g<<8 | r<<16 | a<<24，与 TGAColor 的字节顺序和 sampler.h 的 pack_color 相同
+// 系数是 0..256 的定点数（256 即 1.0）；单个像素的运算把 b、r 和 g、a 各放进一个 32 位字的两个 16 位段里同时计算，
+// 每像素只需几条整数乘法和移位。多像素的版本见文件末尾，编译时打开 TINYRENDERER_SIMD 时用 SSE2 一次处理 4 个像素
+
+// 截断到 [0, 1] 的强度换成定点系数；乘出来的通道与浮点相乘后截断最多差 1
+inline std::uint16_t color_weight(float k) {
+    return std::uint16_t((k>1.f ? 1.f : (k<0.f ? 0.f : k))*256.f);
+}
+
+// 各通道乘以 k/256 后向下取整
+inline std::uint32_t color_scale(std::uint32_t c, unsigned k) {
+    const std::uint32_t M = 0x00FF00FF;
+    return ((c & M)*k >> 8 & M) | ((c >> 8 & M)*k & ~M);
+}
+
+// n 个像素的版本，与逐个调用 color_scale 逐位相同；out 可以与 c 相同
+void color_scale_n(const std::uint32_t *c, const std::uint16_t *k, std::uint32_t *out, size_t n);
+
+#endif //__COLOR_H__
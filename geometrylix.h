@@ -3,6 +3,14 @@
 
 #include <cmath>
 #include <cassert>
+#include <ostream>
+#include <type_traits>
+
+// SSE 可用时 Vec4f / mat<4,4,float> 的运算走 SIMD 路径，否则退回标量实现
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GEOMETRY_SSE 1
+#include <xmmintrin.h>
+#endif
 
 //=============================================================================
 // vec
@@ -11,8 +19,8 @@
 template<int n, typename T> struct vec {
     T data[n] = {0};
 
-    T& operator[](const int i)       { assert(i>=0 && i<n); return data[i]; }
-    T  operator[](const int i) const { assert(i>=0 && i<n); return data[i]; }
+    constexpr T& operator[](const int i)       { assert(i>=0 && i<n); return data[i]; }
+    constexpr T  operator[](const int i) const { assert(i>=0 && i<n); return data[i]; }
 };
 
 template<int n, typename T> vec<n,T> operator+(const vec<n,T> &lvec, const vec<n,T> &rvec) { 
@@ -74,15 +82,15 @@ template<int n, typename T> vec<n,T> normalized(const vec<n,T> &v) {
 template<typename T> struct vec<2,T>
 {
     T x = 0, y = 0;
-    T& operator[](const int i)       { assert(i>=0 && i<2); return i ? y : x; }
-    T  operator[](const int i) const { assert(i>=0 && i<2); return i ? y : x; }
+    constexpr T& operator[](const int i)       { assert(i>=0 && i<2); return i ? y : x; }
+    constexpr T  operator[](const int i) const { assert(i>=0 && i<2); return i ? y : x; }
 };
 
 template<typename T> struct vec<3,T>
 {
     T x = 0, y = 0, z = 0;
-    T& operator[](const int i)       { assert(i>=0 && i<3); return i>1 ? z : (i ? y : x); }
-    T  operator[](const int i) const { 
+    constexpr T& operator[](const int i)       { assert(i>=0 && i<3); return i>1 ? z : (i ? y : x); }
+    constexpr T  operator[](const int i) const { 
         if (i<0 || i>=3) {
             assert(i>=0 && i<3);
         }
@@ -94,12 +102,22 @@ template<typename T> struct vec<3,T>
 template<typename T> struct vec<4,T>
 {
     T x = 0, y = 0, z = 0, w = 0;
-    T& operator[](const int i)       { assert(i>=0 && i<4); return i>1 ? (i==2 ? z : w) : (i ? y : x); }
-    T  operator[](const int i) const { assert(i>=0 && i<4); return i>1 ? (i==2 ? z : w) : (i ? y : x); }
+    constexpr T& operator[](const int i)       { assert(i>=0 && i<4); return i>1 ? (i==2 ? z : w) : (i ? y : x); }
+    constexpr T  operator[](const int i) const { assert(i>=0 && i<4); return i>1 ? (i==2 ? z : w) : (i ? y : x); }
 
     vec<3,T> xyz() { return {x, y, z}; }
 };
 
+// Vec4f 按 16 字节对齐，可以直接整体装入一个 SSE 寄存器；下标访问不再走三目运算链
+template<> struct alignas(16) vec<4,float>
+{
+    float x = 0, y = 0, z = 0, w = 0;
+    constexpr float& operator[](const int i)       { assert(i>=0 && i<4); return std::is_constant_evaluated() ? (i>1 ? (i==2 ? z : w) : (i ? y : x)) : (&x)[i]; }
+    constexpr float  operator[](const int i) const { assert(i>=0 && i<4); return std::is_constant_evaluated() ? (i>1 ? (i==2 ? z : w) : (i ? y : x)) : (&x)[i]; }
+
+    constexpr vec<3,float> xyz() const { return {x, y, z}; }
+};
+
 typedef vec<2,int> Vec2i;
 typedef vec<2,float> Vec2f;
 typedef vec<3,int> Vec3i;
@@ -123,10 +141,19 @@ template <typename T> std::ostream& operator<<(std::ostream& s, vec<3,T>& v) {
 template<int nrows, int ncols, typename T> struct mat {
     vec<ncols,T> data[nrows] = {{}};
 
-          vec<ncols,T>& operator[](const int i)       { assert(i>=0 && i<nrows); return data[i]; }
-    const vec<ncols,T>& operator[](const int i) const { assert(i>=0 && i<nrows); return data[i]; }
+          constexpr vec<ncols,T>& operator[](const int i)       { assert(i>=0 && i<nrows); return data[i]; }
+    constexpr const vec<ncols,T>& operator[](const int i) const { assert(i>=0 && i<nrows); return data[i]; }
 };
 
+template<int n, typename T=float> constexpr mat<n,n,T> identity() {
+    mat<n,n,T> ret;
+    for (int i=0; i<n; i++) {
+        ret[i][i] = 1;
+    }
+
+    return ret;
+}
+
 template<int nrows, int ncols, typename T> mat<nrows,ncols,T> operator+(const mat<nrows,ncols,T> &lmat, const mat<nrows,ncols,T> &rmat) {
     mat<nrows,ncols,T> ret;
     for (int i=0; i<nrows; i++) {
@@ -186,4 +213,167 @@ template<int nrows, int ncols, typename T> vec<ncols,T> operator*(const mat<nrow
     return ret;
 }
 
+template<int nrows, int ncols, typename T> mat<ncols,nrows,T> transpose(const mat<nrows,ncols,T> &m) {
+    mat<ncols,nrows,T> ret;
+    for (int i=0; i<nrows; i++) {
+        for (int j=0; j<ncols; j++) {
+            ret[j][i] = m[i][j];
+        }
+    }
+
+    return ret;
+}
+
+//=============================================================================
+// Vec3f / Vec4f / mat<4,4,float> 的特化运算
+// 非模板重载优先于上面的通用模板，调用方不需要任何改动；常量求值时走标量路径，因此仍然可以是 constexpr
+//=============================================================================
+
+constexpr float operator*(const Vec3f &l, const Vec3f &r) {
+    return l.x*r.x + l.y*r.y + l.z*r.z;
+}
+
+constexpr Vec3f cross(const Vec3f &l, const Vec3f &r) {
+    return {l.y*r.z - l.z*r.y, l.z*r.x - l.x*r.z, l.x*r.y - l.y*r.x};
+}
+
+inline Vec3f normalized(const Vec3f &v) {
+    float inv = 1.f/std::sqrt(v*v);
+    return {v.x*inv, v.y*inv, v.z*inv};
+}
+
+#ifdef GEOMETRY_SSE
+inline __m128 load(const Vec4f &v)     { return _mm_load_ps(&v.x); }
+inline Vec4f  store(__m128 m)          { Vec4f v; _mm_store_ps(&v.x, m); return v; }
+#endif
+
+constexpr Vec4f operator+(const Vec4f &l, const Vec4f &r) {
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) return store(_mm_add_ps(load(l), load(r)));
+#endif
+    return {l.x+r.x, l.y+r.y, l.z+r.z, l.w+r.w};
+}
+
+constexpr Vec4f operator-(const Vec4f &l, const Vec4f &r) {
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) return store(_mm_sub_ps(load(l), load(r)));
+#endif
+    return {l.x-r.x, l.y-r.y, l.z-r.z, l.w-r.w};
+}
+
+constexpr Vec4f operator*(const Vec4f &l, const float &r) {
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) return store(_mm_mul_ps(load(l), _mm_set1_ps(r)));
+#endif
+    return {l.x*r, l.y*r, l.z*r, l.w*r};
+}
+
+constexpr Vec4f operator*(const float &r, const Vec4f &l) {
+    return l*r;
+}
+
+constexpr Vec4f operator/(const Vec4f &l, const float &r) {
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) return store(_mm_div_ps(load(l), _mm_set1_ps(r)));
+#endif
+    return {l.x/r, l.y/r, l.z/r, l.w/r};
+}
+
+constexpr float operator*(const Vec4f &l, const Vec4f &r) {
+    return l.x*r.x + l.y*r.y + l.z*r.z + l.w*r.w;
+}
+
+inline Vec4f normalized(const Vec4f &v) {
+    return v*(1.f/std::sqrt(v*v));
+}
+
+// 行主序存储：结果的第 i 行 = sum_k l[i][k] * r 的第 k 行，正好是广播乘加
+constexpr mat<4,4,float> operator*(const mat<4,4,float> &l, const mat<4,4,float> &r) {
+    mat<4,4,float> ret;
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) {
+        __m128 r0 = load(r[0]), r1 = load(r[1]), r2 = load(r[2]), r3 = load(r[3]);
+        for (int i=0; i<4; i++) {
+            __m128 acc = _mm_mul_ps(_mm_set1_ps(l[i].x), r0);
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(l[i].y), r1));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(l[i].z), r2));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(l[i].w), r3));
+            ret[i] = store(acc);
+        }
+        return ret;
+    }
+#endif
+    for (int i=0; i<4; i++) {
+        for (int j=0; j<4; j++) {
+            ret[i][j] = l[i][0]*r[0][j] + l[i][1]*r[1][j] + l[i][2]*r[2][j] + l[i][3]*r[3][j];
+        }
+    }
+    return ret;
+}
+
+constexpr Vec4f operator*(const mat<4,4,float> &m, const Vec4f &v) {
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) {
+        // 转置后按列广播乘加，避免逐行水平求和
+        __m128 c0 = load(m[0]), c1 = load(m[1]), c2 = load(m[2]), c3 = load(m[3]);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        __m128 acc = _mm_mul_ps(c0, _mm_set1_ps(v.x));
+        acc = _mm_add_ps(acc, _mm_mul_ps(c1, _mm_set1_ps(v.y)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(c2, _mm_set1_ps(v.z)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(c3, _mm_set1_ps(v.w)));
+        return store(acc);
+    }
+#endif
+    return {m[0]*v, m[1]*v, m[2]*v, m[3]*v};
+}
+
+constexpr mat<4,4,float> transpose(const mat<4,4,float> &m) {
+#ifdef GEOMETRY_SSE
+    if (!std::is_constant_evaluated()) {
+        __m128 r0 = load(m[0]), r1 = load(m[1]), r2 = load(m[2]), r3 = load(m[3]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        return {{store(r0), store(r1), store(r2), store(r3)}};
+    }
+#endif
+    return {{{m[0].x, m[1].x, m[2].x, m[3].x},
+             {m[0].y, m[1].y, m[2].y, m[3].y},
+             {m[0].z, m[1].z, m[2].z, m[3].z},
+             {m[0].w, m[1].w, m[2].w, m[3].w}}};
+}
+
+// 伴随矩阵 / 行列式；只在每次 draw 时算一次，用 2x2 子式展开的标量实现即可
+constexpr mat<4,4,float> inverse(const mat<4,4,float> &m) {
+    float s0 = m[0][0]*m[1][1] - m[1][0]*m[0][1];
+    float s1 = m[0][0]*m[1][2] - m[1][0]*m[0][2];
+    float s2 = m[0][0]*m[1][3] - m[1][0]*m[0][3];
+    float s3 = m[0][1]*m[1][2] - m[1][1]*m[0][2];
+    float s4 = m[0][1]*m[1][3] - m[1][1]*m[0][3];
+    float s5 = m[0][2]*m[1][3] - m[1][2]*m[0][3];
+    float c5 = m[2][2]*m[3][3] - m[3][2]*m[2][3];
+    float c4 = m[2][1]*m[3][3] - m[3][1]*m[2][3];
+    float c3 = m[2][1]*m[3][2] - m[3][1]*m[2][2];
+    float c2 = m[2][0]*m[3][3] - m[3][0]*m[2][3];
+    float c1 = m[2][0]*m[3][2] - m[3][0]*m[2][2];
+    float c0 = m[2][0]*m[3][1] - m[3][0]*m[2][1];
+    float det = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+    assert(det != 0);
+    float inv = 1.f/det;
+
+    mat<4,4,float> ret;
+    ret[0] = {( m[1][1]*c5 - m[1][2]*c4 + m[1][3]*c3)*inv, (-m[0][1]*c5 + m[0][2]*c4 - m[0][3]*c3)*inv,
+              ( m[3][1]*s5 - m[3][2]*s4 + m[3][3]*s3)*inv, (-m[2][1]*s5 + m[2][2]*s4 - m[2][3]*s3)*inv};
+    ret[1] = {(-m[1][0]*c5 + m[1][2]*c2 - m[1][3]*c1)*inv, ( m[0][0]*c5 - m[0][2]*c2 + m[0][3]*c1)*inv,
+              (-m[3][0]*s5 + m[3][2]*s2 - m[3][3]*s1)*inv, ( m[2][0]*s5 - m[2][2]*s2 + m[2][3]*s1)*inv};
+    ret[2] = {( m[1][0]*c4 - m[1][1]*c2 + m[1][3]*c0)*inv, (-m[0][0]*c4 + m[0][1]*c2 - m[0][3]*c0)*inv,
+              ( m[3][0]*s4 - m[3][1]*s2 + m[3][3]*s0)*inv, (-m[2][0]*s4 + m[2][1]*s2 - m[2][3]*s0)*inv};
+    ret[3] = {(-m[1][0]*c3 + m[1][1]*c1 - m[1][2]*c0)*inv, ( m[0][0]*c3 - m[0][1]*c1 + m[0][2]*c0)*inv,
+              (-m[3][0]*s3 + m[3][1]*s1 - m[3][2]*s0)*inv, ( m[2][0]*s3 - m[2][1]*s1 + m[2][2]*s0)*inv};
+    return ret;
+}
+
+// 法线变换矩阵：(M^-1)^T
+constexpr mat<4,4,float> invert_transpose(const mat<4,4,float> &m) {
+    return transpose(inverse(m));
+}
+
 #endif //__GEOMETRY_LIX_H__
\ No newline at end of file
@@ -1,84 +1,607 @@
 #ifndef __GL_H__
 #define __GL_H__
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <vector>
 #include "tgaimage.h"
 #include "geometrylix.h"
+#include "profiler.h"
+#include "sampler.h"
 
-mat<4,4,float> ModelView;
-mat<4,4,float> Projection;
-mat<4,4,float> Viewport;
+inline mat<4,4,float> ModelView;
+inline mat<4,4,float> Projection;
+inline mat<4,4,float> Viewport;
 
-void set_modelview(Vec3f camera_pos, Vec3f center, Vec3f up) {
+// 纯函数形式的矩阵构造，供不能共享全局相机的场合（如多线程的渲染服务）使用；set_* 只是把结果写入全局变量
+inline mat<4,4,float> lookat(Vec3f camera_pos, Vec3f center, Vec3f up) {
     Vec3f z = normalized(camera_pos - center);
     Vec3f x = normalized(cross(up, z));
     Vec3f y = normalized(cross(z, x));
 
-    ModelView = mat<4,4,float>({{x.x, x.y, x.z, 0}, {y.z, y.y, y.z, 0}, {z.x, z.y, z.z, 0}, {0,0,0,1}}) * mat<4,4,float>({{1,0,0,-camera_pos.x}, {0,1,0,-camera_pos.y}, {0,0,1,-camera_pos.z}, {0,0,0,1}});
+    return mat<4,4,float>({{x.x, x.y, x.z, 0}, {y.z, y.y, y.z, 0}, {z.x, z.y, z.z, 0}, {0,0,0,1}}) * mat<4,4,float>({{1,0,0,-camera_pos.x}, {0,1,0,-camera_pos.y}, {0,0,1,-camera_pos.z}, {0,0,0,1}});
 }
 
-void set_projection(float coeff) {
-    Projection = {{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,coeff,1}}};
+inline mat<4,4,float> projection(float coeff) {
+    return {{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,coeff,1}}};
 }
 
-void set_viewport(int x, int y, int w, int h) {
-    Viewport = {{{w/2.f, 0, 0, x+w/2.f}, {0, h/2.f, 0, y+h/2.f}, {0,0,1,0}, {0,0,0,1}}};
+inline mat<4,4,float> viewport(int x, int y, int w, int h) {
+    return {{{w/2.f, 0, 0, x+w/2.f}, {0, h/2.f, 0, y+h/2.f}, {0,0,1,0}, {0,0,0,1}}};
 }
 
+inline void set_modelview(Vec3f camera_pos, Vec3f center, Vec3f up) {
+    ModelView = lookat(camera_pos, center, up);
+}
+
+inline void set_projection(float coeff) {
+    Projection = projection(coeff);
+}
+
+inline void set_viewport(int x, int y, int w, int h) {
+    Viewport = viewport(x, y, w, h);
+}
+
+// 模型坐标包围球在屏幕上的近似半径（像素），用于 LOD 选择
+inline float projected_radius(Vec3f center, float radius, const mat<4,4,float> &proj, const mat<4,4,float> &view, const mat<4,4,float> &vp) {
+    Vec4f c = proj*view*Vec4f(center.x, center.y, center.z, 1);
+    return radius*std::max(std::abs(vp[0][0]), std::abs(vp[1][1]))/std::abs(c.w);
+}
+
+inline float projected_radius(Vec3f center, float radius) {
+    return projected_radius(center, radius, Projection, ModelView, Viewport);
+}
+
+const int MAX_VARYINGS = 16;
+
+// 可变着色率：每个 w x h 的像素块只调用一次片段着色器，颜色广播到块内所有通过覆盖和深度测试的像素
+// 覆盖和深度仍逐像素判断；块按屏幕坐标对齐
+enum class ShadingRate { R1x1, R1x2, R2x2, R4x4 };
+
+inline int rate_log2w(ShadingRate r) { return r==ShadingRate::R4x4 ? 2 : r==ShadingRate::R2x2 ? 1 : 0; }
+inline int rate_log2h(ShadingRate r) { return r==ShadingRate::R4x4 ? 2 : r==ShadingRate::R1x1 ? 0 : 1; }
+
+// "1x1"、"1x2"、"2x2"、"4x4"
+inline bool parse_shading_rate(const std::string &s, ShadingRate &rate) {
+    const char *names[] = {"1x1", "1x2", "2x2", "4x4"};
+    for (int i=0; i<4; i++)
+        if (s==names[i]) { rate = ShadingRate(i); return true; }
+    return false;
+}
+
+// 按屏幕分块（tile 像素见方，须为 4 的倍数）指定的着色率
+struct RateImage {
+    int tile = 16;
+    int w = 0, h = 0;                   // 块数
+    std::vector<ShadingRate> rates;
+
+    RateImage() = default;
+    RateImage(int width, int height, int tile = 16, ShadingRate rate = ShadingRate::R1x1)
+        : tile(tile), w((width + tile - 1)/tile), h((height + tile - 1)/tile), rates(w*h, rate) {}
+
+    ShadingRate get(int x, int y) const { return rates[x/tile + (y/tile)*w]; }
+    void set(int tx, int ty, ShadingRate rate) { rates[tx + ty*w] = rate; }
+
+    // 每个像素对应一块，灰度值 0-63/64-127/128-191/192-255 分别为 1x1/1x2/2x2/4x4
+    static RateImage from_image(const TGAImage &img, int tile = 16) {
+        RateImage r;
+        r.tile = tile;
+        r.w = img.width();
+        r.h = img.height();
+        r.rates.resize(r.w*r.h);
+        for (int y=0; y<r.h; y++)
+            for (int x=0; x<r.w; x++) r.rates[x + y*r.w] = ShadingRate(img.get(x, y).bgra[0] >> 6);
+        return r;
+    }
+
+    // 按图像内容选着色率：块内相邻像素的最大亮度差越小，着色越粗；threshold 为 1x1 与 1x2 的分界，之后每级减半
+    // 可以用上一帧的结果为下一帧选择着色率
+    static RateImage from_contrast(const TGAImage &img, int tile = 16, int threshold = 32) {
+        RateImage r(img.width(), img.height(), tile);
+        auto luma = [&img](int x, int y) {
+            TGAColor c = img.get(x, y);
+            return img.bytespp()==1 ? c.bgra[0] : (c.bgra[0] + 2*c.bgra[1] + c.bgra[2])/4;
+        };
+        for (int ty=0; ty<r.h; ty++) {
+            for (int tx=0; tx<r.w; tx++) {
+                int contrast = 0;
+                for (int y=ty*tile; y<std::min((ty+1)*tile, img.height()); y++)
+                    for (int x=tx*tile; x<std::min((tx+1)*tile, img.width()); x++) {
+                        int l = luma(x, y);
+                        if (x+1 < img.width())  contrast = std::max(contrast, std::abs(l - luma(x+1, y)));
+                        if (y+1 < img.height()) contrast = std::max(contrast, std::abs(l - luma(x, y+1)));
+                    }
+                ShadingRate rate = contrast >= threshold   ? ShadingRate::R1x1 :
+                                   contrast >= threshold/2 ? ShadingRate::R1x2 :
+                                   contrast >= threshold/4 ? ShadingRate::R2x2 : ShadingRate::R4x4;
+                r.set(tx, ty, rate);
+            }
+        }
+        return r;
+    }
+};
+
+// 批量片段着色的输入输出：8 个片段按结构数组（SoA）存放，每个属性的 8 路连续，一条 8 路向量指令处理一个属性
+struct FragmentBatch {
+    enum { SIZE = 8 };
+    unsigned mask = 0;                  // 第 i 位为 1 表示第 i 路是有效片段，其余路的输入是残留值
+    int   x[SIZE], y[SIZE];
+    float z[SIZE];
+    float bc[3][SIZE];                  // 透视校正后的重心坐标
+    float u[SIZE], v[SIZE];
+    float varying[MAX_VARYINGS][SIZE];  // 已透视校正，对应 frag_varying
+    std::uint32_t color[SIZE];          // 输出，打包方式见 sampler.h
+};
+
 struct IShader {
-    // virtual ~IShader();
-    // 输入顶点模型坐标；返回屏幕坐标；顶点着色器的主要目标是变换顶点的坐标，次要目标是为片段着色器准备数据
-    virtual Vec4f vertex(Vec3f vert, Vec3f normal, int ivert);     
-    // 片段着色器的主要目标是确定当前像素的颜色，次要目标是我们可以通过返回 true 来丢弃当前像素        
-    virtual bool fragment(Vec3f bc, Vec2f uv, TGAColor &color);
+    // varying 布局：顶点着色器写入 varying[ivert][0..nvaryings)，光栅化时按透视校正插值到 frag_varying
+    int   nvaryings = 0;
+    float varying[3][MAX_VARYINGS] = {};
+    float frag_varying[MAX_VARYINGS] = {};
+    int   iface = -1;                   // 当前面在模型中的下标，由 draw_faces 在调用 vertex 前设置；没有模型时为 -1
+
+    // 着色率：rate 对整个 draw 生效；rates 非空时逐块取两者中较粗的一个
+    ShadingRate rate = ShadingRate::R1x1;
+    const RateImage *rates = NULL;
+
+    // uniform：模型矩阵（实例变换）、完整的 Viewport*Projection*ModelView*M、法线矩阵
+    mat<4,4,float> uniform_M   = identity<4>();
+    mat<4,4,float> uniform_MVP = identity<4>();
+    mat<4,4,float> uniform_N   = identity<4>();
+    // 是否显式 bind 过；没有时每次 draw 开始由 prepare 按当时的全局相机设置 uniform
+    bool bound = false;
+
+    virtual ~IShader() {}
+
+    // 相机矩阵或模型矩阵改变后调用，每次 draw/实例只算一次矩阵乘法和求逆；绑定后不再跟随全局相机
+    void bind(const mat<4,4,float> &M) {
+        bind(M, Viewport*Projection*ModelView);
+    }
+
+    // camera 为 Viewport*Projection*ModelView，不读全局相机
+    void bind(const mat<4,4,float> &M, const mat<4,4,float> &camera) {
+        set_uniforms(M, camera);
+        bound = true;
+    }
+
+    // 恢复为未绑定：之后的 draw 重新跟随全局相机
+    void unbind() { bound = false; }
+
+    // 送入顶点之前由 draw 调用（draw_faces、分带和流式渲染）；未绑定时取当前的全局相机和单位模型矩阵
+    void prepare() {
+        if (!bound) set_uniforms(identity<4>(), Viewport*Projection*ModelView);
+    }
+
+    void set_uniforms(const mat<4,4,float> &M, const mat<4,4,float> &camera) {
+        uniform_M   = M;
+        uniform_MVP = camera*M;
+        uniform_N   = invert_transpose(M);
+    }
+
+    // 输入顶点模型坐标；返回齐次裁剪坐标（透视除法由光栅化完成）；顶点着色器的主要目标是变换顶点的坐标，次要目标是为片段着色器准备数据
+    virtual Vec4f vertex(Vec3f vert, Vec3f normal, int ivert) = 0;
+    // 片段着色器的主要目标是确定当前像素的颜色，次要目标是我们可以通过返回 true 来丢弃当前像素
+    // bc 为透视校正后的重心坐标，frag_varying 已插值完毕
+    virtual bool fragment(Vec3f bc, Vec2f uv, TGAColor &color) = 0;
+
+    // 批量接口：batched 为 true 时，着色率为 1x1 的片段凑满 8 个后一起交给 fragment_batch，省掉逐像素的虚函数调用并可以向量化
+    // 结果须与逐个调用 fragment 相同；子类只重写 fragment 时须把 batched 置回 false
+    bool batched = false;
+    // 写 batch.color 中 mask 所标出的各路，返回要丢弃的片段的掩码；默认实现逐个调用 fragment
+    virtual unsigned fragment_batch(FragmentBatch &batch) {
+        unsigned discard = 0;
+        for (int i=0; i<FragmentBatch::SIZE; i++) {
+            if (!(batch.mask >> i & 1)) continue;
+            for (int k=0; k<nvaryings; k++) frag_varying[k] = batch.varying[k][i];
+            TGAColor color;
+            if (fragment(Vec3f(batch.bc[0][i], batch.bc[1][i], batch.bc[2][i]), Vec2f(batch.u[i], batch.v[i]), color)) discard |= 1u << i;
+            batch.color[i] = pack_color(color);
+        }
+        return discard;
+    }
 };
 
-Vec3f barycentric(Vec4f p0, Vec4f p1, Vec4f p2, Vec3i p)
+inline Vec3f barycentric(Vec4f p0, Vec4f p1, Vec4f p2, Vec3i p)
 {
     Vec3f u = cross(Vec3f(p1.x - p0.x, p2.x - p0.x, p0.x - p.x), Vec3f(p1.y - p0.y, p2.y - p0.y, p0.y - p.y));
 
-    return Vec3f(1 - (u.x + u.y) / u.z, u.x/u.z, u.y/u.z); 
+    return Vec3f(1 - (u.x + u.y) / u.z, u.x/u.z, u.y/u.z);
 }
 
-void triangle(Vec4f *pts, Vec2f* uvs, IShader &shader, TGAImage &image, float* zbuffer) {
-    // 三角面包围盒
-    Vec2f minBox(image.width()-1,  image.height()-1);
-    Vec2f maxBox(0, 0);
-    minBox.x = std::min(minBox.x, pts[0].x);
-    minBox.x = std::min(minBox.x, pts[1].x);
-    minBox.x = std::min(minBox.x, pts[2].x);
-    minBox.y = std::min(minBox.y, pts[0].y);
-    minBox.y = std::min(minBox.y, pts[1].y);
-    minBox.y = std::min(minBox.y, pts[2].y);
-    
-    maxBox.x = std::max(maxBox.x, pts[0].x);
-    maxBox.x = std::max(maxBox.x, pts[1].x);
-    maxBox.x = std::max(maxBox.x, pts[2].x);
-    maxBox.y = std::max(maxBox.y, pts[0].y);
-    maxBox.y = std::max(maxBox.y, pts[1].y);
-    maxBox.y = std::max(maxBox.y, pts[2].y);
-
-    Vec2f uv;
-    Vec3i p;
-    TGAColor color;
-    for (p.x=minBox.x; p.x<=maxBox.x; p.x++)
-    {
-        for (p.y=minBox.y; p.y<=maxBox.y; p.y++)
+// 覆盖测试的容差，避免共享边上的像素因舍入误差被两个三角形同时漏掉
+const float EDGE_EPS = 1e-5f;
+
+// 屏幕空间线性属性的平面方程 f(x,y) = a + dx*x + dy*y
+struct Plane {
+    float a = 0, dx = 0, dy = 0;
+};
+
+// 三角形建立阶段：每个三角形只做一次，之后内循环每步每个属性只需一次加法
+// 槽位布局：l1, l2 为屏幕空间重心坐标（覆盖测试），z 为深度，之后的槽位都预先除以 w，用 1/w 做透视校正
+// 分两步：setup_edges 只建立覆盖和深度需要的三个平面，微三角形可以先测试像素，没有像素通过时省掉属性平面
+struct TriangleSetup {
+    enum { L1, L2, Z, OOW, BC0, BC1, U, V, VARY, NSLOTS = VARY + MAX_VARYINGS };
+    int   nslots = VARY;
+    Plane planes[NSLOTS];
+    float area;                         // 屏幕空间有向面积的两倍
+
+    // 返回 false 表示退化三角形
+    bool setup(const Vec4f *clip, const Vec2f *uvs, const IShader &shader, Vec3f *screen) {
+        if (!setup_edges(clip, screen)) return false;
+        setup_attributes(uvs, shader);
+        return true;
+    }
+
+    bool setup_edges(const Vec4f *clip, Vec3f *screen) {
+        for (int i=0; i<3; i++) {
+            oow[i] = 1.f/clip[i].w;
+            screen[i] = Vec3f(clip[i].x*oow[i], clip[i].y*oow[i], clip[i].z*oow[i]);
+        }
+        x0 = screen[0].x; y0 = screen[0].y;
+        e1x = screen[1].x - screen[0].x; e1y = screen[1].y - screen[0].y;
+        e2x = screen[2].x - screen[0].x; e2y = screen[2].y - screen[0].y;
+        area = e1x*e2y - e2x*e1y;
+        if (std::abs(area) < 1e-6f) return false;
+        inv = 1.f/area;
+        planes[L1] = plane(0, 1, 0);
+        planes[L2] = plane(0, 0, 1);
+        planes[Z]  = plane(screen[0].z, screen[1].z, screen[2].z);
+        return true;
+    }
+
+    void setup_attributes(const Vec2f *uvs, const IShader &shader) {
+        planes[OOW] = plane(oow[0], oow[1], oow[2]);
+        planes[BC0] = plane(oow[0], 0, 0);
+        planes[BC1] = plane(0, oow[1], 0);
+        planes[U]   = plane(uvs[0].x*oow[0], uvs[1].x*oow[1], uvs[2].x*oow[2]);
+        planes[V]   = plane(uvs[0].y*oow[0], uvs[1].y*oow[1], uvs[2].y*oow[2]);
+        nslots = VARY + shader.nvaryings;
+        for (int k=0; k<shader.nvaryings; k++)
+            planes[VARY+k] = plane(shader.varying[0][k]*oow[0], shader.varying[1][k]*oow[1], shader.varying[2][k]*oow[2]);
+    }
+
+    // 第三条边 l0 = 1 - l1 - l2 的平面
+    Plane edge0() const {
+        Plane p;
+        p.a  = 1 - planes[L1].a - planes[L2].a;
+        p.dx = -planes[L1].dx - planes[L2].dx;
+        p.dy = -planes[L1].dy - planes[L2].dy;
+        return p;
+    }
+
+private:
+    float oow[3], x0, y0, e1x, e1y, e2x, e2y, inv;
+
+    Plane plane(float f0, float f1, float f2) const {
+        Plane p;
+        p.dx = ((f1-f0)*e2y - (f2-f0)*e1y)*inv;
+        p.dy = ((f2-f0)*e1x - (f1-f0)*e2x)*inv;
+        p.a  = f0 - p.dx*x0 - p.dy*y0;
+        return p;
+    }
+};
+
+// 可变着色率：逐列缓存最近一次着色的块；块宽最多 4 像素，按 4 对齐后块左上角的列号可以直接作下标
+struct RateBlock { int y; bool discard; TGAColor color; };
+
+// 一个三角形的光栅化状态；三种遍历方式只在生成哪些行段上不同，行段内的覆盖测试、深度测试和着色都由 span 完成，
+// 像素在每一行内按 x 递增、在每一列内按 y 递增访问，可变着色率的块缓存照常工作
+// 插值量每行在 xmin 处从平面方程求值一次，之后逐像素累加 dx（跳过的像素也累加），
+// 因此每个像素的覆盖、深度和属性都与逐个遍历包围盒时逐位相同，只是省掉了段外像素的测试
+struct TriangleRaster {
+    const TriangleSetup &ts;
+    IShader &shader;
+    TGAImage &image;
+    float *zbuffer;
+    bool timed;
+    bool coarse = false;
+    int xbase = 0;
+    int xmin = 0;
+    RateBlock *blocks = NULL;
+    FragmentBatch *batch = NULL;        // 非空时通过深度测试的片段先攒进 batch，满 8 个或三角形结束时 flush
+    int nbatch = 0;
+    std::int64_t t_frag = 0, nfrag = 0, ntested = 0;
+    float val[TriangleSetup::NSLOTS];   // 当前行在 x 处的插值量
+    int x = 0;
+
+    TriangleRaster(const TriangleSetup &ts, IShader &shader, TGAImage &image, float *zbuffer, bool timed)
+        : ts(ts), shader(shader), image(image), zbuffer(zbuffer), timed(timed) {}
+
+    // 同一个三角形的片段互不重叠，深度测试可以早于攒批之前的写入
+    void flush() {
+        if (!nbatch) return;
+        batch->mask = (1u << nbatch) - 1;
+        std::int64_t t0 = timed ? profiler::now() : 0;
+        unsigned discard = shader.fragment_batch(*batch);
+        if (timed) {
+            t_frag += profiler::now() - t0;
+            nfrag += nbatch;
+        }
+        for (int i=0; i<nbatch; i++) {
+            if (discard >> i & 1) continue;
+            zbuffer[batch->x[i] + batch->y[i]*image.width()] = batch->z[i];
+            image.set_packed(batch->x[i], batch->y[i], batch->color[i]);
+        }
+        nbatch = 0;
+    }
+
+    // 每行从平面方程重新求值，避免累加误差跨行传播
+    void begin_row(int y) {
+        for (int k=0; k<ts.nslots; k++) val[k] = ts.planes[k].a + ts.planes[k].dx*xmin + ts.planes[k].dy*y;
+        x = xmin;
+    }
+
+    // 第 y 行的 [xl, xr]；同一行的段须在 begin_row(y) 之后按 x 递增给出
+    void span(int y, int xl, int xr) {
+        const int n = ts.nslots;
+        for (; x<xl; x++)
+            for (int k=0; k<n; k++) val[k] += ts.planes[k].dx;
+        if (timed && xr >= xl) ntested += xr - xl + 1;
+        TGAColor color;
+        for (; x<=xr; x++)
         {
-            Vec3f bc = barycentric(pts[0], pts[1], pts[2], p);
-            if (bc.x < 0 || bc.y < 0 || bc.z < 0) continue;         // 跳过在三角面外的像素
-
-            float z = pts[0].z*bc.x + pts[1].z*bc.y + pts[2].z*bc.z;    
-            float w = pts[0].w*bc.x + pts[1].w*bc.y + pts[2].w*bc.z;   
-            int depth = z/w;
-            if (zbuffer[int(p.x+ p.y*image.width())] > z) continue;
-
-            uv = uvs[0]*bc.x + uvs[1]*bc.y + uvs[2]*bc.z;
-            bool discard = shader.fragment(bc, uv, color);
-            if (!discard) {
-                zbuffer[int(p.x+ p.y*image.width())] = z;
-                image.set(p.x, p.y, color);
+            float l1 = val[TriangleSetup::L1], l2 = val[TriangleSetup::L2];
+            float z  = val[TriangleSetup::Z];
+            // 跳过在三角面外或被遮挡的像素
+            if (l1 >= -EDGE_EPS && l2 >= -EDGE_EPS && l1 + l2 <= 1 + EDGE_EPS && zbuffer[x + y*image.width()] <= z)
+            {
+                if (batch) {
+                    int i = nbatch;
+                    float w = 1.f/val[TriangleSetup::OOW];
+                    float b0 = val[TriangleSetup::BC0]*w, b1 = val[TriangleSetup::BC1]*w;
+                    batch->x[i] = x;
+                    batch->y[i] = y;
+                    batch->z[i] = z;
+                    batch->bc[0][i] = b0;
+                    batch->bc[1][i] = b1;
+                    batch->bc[2][i] = 1 - b0 - b1;
+                    batch->u[i] = val[TriangleSetup::U]*w;
+                    batch->v[i] = val[TriangleSetup::V]*w;
+                    for (int k=TriangleSetup::VARY; k<n; k++) batch->varying[k-TriangleSetup::VARY][i] = val[k]*w;
+                    if (++nbatch==FragmentBatch::SIZE) flush();
+                    for (int k=0; k<n; k++) val[k] += ts.planes[k].dx;
+                    continue;
+                }
+                // 块以左上角的行号标识，同一块内已着色过的像素直接复用颜色
+                bool discard = false, shaded = false;
+                RateBlock *block = NULL;
+                if (coarse) {
+                    ShadingRate r = shader.rates ? std::max(shader.rate, shader.rates->get(x, y)) : shader.rate;
+                    int bx = (x >> rate_log2w(r)) << rate_log2w(r), by = (y >> rate_log2h(r)) << rate_log2h(r);
+                    block = &blocks[bx - xbase];
+                    if (block->y == by) {
+                        discard = block->discard;
+                        color = block->color;
+                        shaded = true;
+                    } else {
+                        block->y = by;
+                    }
+                }
+                if (!shaded) {
+                    float w = 1.f/val[TriangleSetup::OOW];
+                    float b0 = val[TriangleSetup::BC0]*w, b1 = val[TriangleSetup::BC1]*w;
+                    Vec3f bc(b0, b1, 1 - b0 - b1);
+                    Vec2f uv(val[TriangleSetup::U]*w, val[TriangleSetup::V]*w);
+                    for (int k=TriangleSetup::VARY; k<n; k++) shader.frag_varying[k-TriangleSetup::VARY] = val[k]*w;
+
+                    std::int64_t t0 = timed ? profiler::now() : 0;
+                    discard = shader.fragment(bc, uv, color);
+                    if (timed) {
+                        t_frag += profiler::now() - t0;
+                        nfrag++;
+                    }
+                    if (block) {
+                        block->discard = discard;
+                        block->color = color;
+                    }
+                }
+                if (!discard) {
+                    zbuffer[x + y*image.width()] = z;
+                    image.set(x, y, color);
+                }
+            }
+            for (int k=0; k<n; k++) val[k] += ts.planes[k].dx;
+        }
+    }
+};
+
+// 按屏幕大小和形状选择遍历方式的阈值
+const int RASTER_MICRO_SIZE = 4;        // 包围盒宽高都不超过 4 像素：微三角形，通常只覆盖 1~4 个像素
+const int RASTER_TILE       = 8;        // 中等三角形按 8x8 的块遍历，整块在某条边外侧时跳过
+const int RASTER_LARGE      = 64*64;    // 包围盒超过这么多像素的大三角形逐行求出精确的覆盖区间
+const float RASTER_SLIVER   = .125f;    // 面积不到包围盒 1/8 的细长三角形同样逐行求区间
+
+inline void triangle(Vec4f *clip, Vec2f* uvs, IShader &shader, TGAImage &image, float* zbuffer) {
+    // 开启计时时单独统计片段着色（虚函数调用）的时间，其余记为光栅化
+    const bool timed = PROFILE_ENABLED();
+    std::int64_t t_begin = timed ? profiler::now() : 0;
+
+    TriangleSetup ts;
+    Vec3f pts[3];
+    if (!ts.setup_edges(clip, pts)) return;
+
+    // 三角面包围盒，裁剪到图像范围内
+    int xmin = std::max(0,                  (int)std::floor(std::min({pts[0].x, pts[1].x, pts[2].x})));
+    int ymin = std::max(0,                  (int)std::floor(std::min({pts[0].y, pts[1].y, pts[2].y})));
+    int xmax = std::min(image.width()-1,    (int)std::ceil (std::max({pts[0].x, pts[1].x, pts[2].x})));
+    int ymax = std::min(image.height()-1,   (int)std::ceil (std::max({pts[0].y, pts[1].y, pts[2].y})));
+    if (xmin > xmax || ymin > ymax) return;
+    const int bw = xmax - xmin + 1, bh = ymax - ymin + 1;
+
+    // 微三角形：先只用 l1, l2, z 测试包围盒内的几个像素，全部不可见时不建立属性平面也不进入行循环；
+    // 与 TriangleRaster 一样按行累加，测试结果与之后的逐像素测试相同
+    const bool micro = bw <= RASTER_MICRO_SIZE && bh <= RASTER_MICRO_SIZE;
+    if (micro) {
+        const Plane &p1 = ts.planes[TriangleSetup::L1], &p2 = ts.planes[TriangleSetup::L2], &pz = ts.planes[TriangleSetup::Z];
+        bool visible = false;
+        for (int y=ymin; y<=ymax && !visible; y++) {
+            float l1 = p1.a + p1.dx*xmin + p1.dy*y, l2 = p2.a + p2.dx*xmin + p2.dy*y, z = pz.a + pz.dx*xmin + pz.dy*y;
+            for (int x=xmin; x<=xmax && !visible; x++, l1+=p1.dx, l2+=p2.dx, z+=pz.dx)
+                visible = l1 >= -EDGE_EPS && l2 >= -EDGE_EPS && l1 + l2 <= 1 + EDGE_EPS && zbuffer[x + y*image.width()] <= z;
+        }
+        if (!visible) {
+            if (timed) {
+                profiler::add_time("raster", profiler::now() - t_begin);
+                profiler::count("tri_micro", 1);
+                profiler::count("tri_micro_culled", 1);
+                profiler::count("coverage_tests", bw*bh);
+            }
+            return;
+        }
+    }
+    ts.setup_attributes(uvs, shader);
+
+    TriangleRaster raster(ts, shader, image, zbuffer, timed);
+    raster.xmin = xmin;
+    raster.coarse = shader.rate != ShadingRate::R1x1 || shader.rates;
+    static thread_local std::vector<RateBlock> blocks;
+    if (raster.coarse) {
+        raster.xbase = xmin & ~3;
+        blocks.assign(xmax - raster.xbase + 1, RateBlock{-1, false, TGAColor()});
+        raster.blocks = blocks.data();
+    }
+    // 粗粒度着色要立即拿到颜色供同一块的像素复用，不攒批
+    static thread_local FragmentBatch batch;
+    if (shader.batched && !raster.coarse) raster.batch = &batch;
+
+    const char *kind;
+    if (micro) {
+        kind = "tri_micro";
+        for (int y=ymin; y<=ymax; y++) {
+            raster.begin_row(y);
+            raster.span(y, xmin, xmax);
+        }
+    } else if (bw*bh > RASTER_LARGE || .5f*std::abs(ts.area) < RASTER_SLIVER*bw*bh) {
+        // 扫描线：每行解出三条边都不为负的 x 区间，再向两侧各放宽一个像素吸收舍入误差，区间内照常逐像素测试，
+        // 覆盖结果与遍历整个包围盒相同
+        kind = "tri_scanline";
+        const Plane edges[3] = { ts.planes[TriangleSetup::L1], ts.planes[TriangleSetup::L2], ts.edge0() };
+        for (int y=ymin; y<=ymax; y++) {
+            float lo = xmin, hi = xmax;
+            for (int e=0; e<3; e++) {
+                float c = edges[e].a + edges[e].dy*y + EDGE_EPS;    // 该行上 c + dx*x >= 0
+                if (edges[e].dx > 0)      lo = std::max(lo, -c/edges[e].dx);
+                else if (edges[e].dx < 0) hi = std::min(hi, -c/edges[e].dx);
+                else if (c < 0)           hi = lo - 1;
             }
+            if (!(lo <= hi + 2)) continue;                          // 区间为空（或出现 NaN）
+            raster.begin_row(y);
+            raster.span(y, std::max(xmin, (int)std::floor(lo) - 1), std::min(xmax, (int)std::ceil(hi) + 1));
+        }
+    } else {
+        // 分块：块按 8 对齐（与着色率块的 4 对齐兼容），线性函数在块上的最大值取在某个角上，任一条边的最大值为负时整块跳过；
+        // 先标出一行块中哪些要跳过，再逐行把相邻的不跳过的块连成一段
+        kind = "tri_block";
+        const Plane edges[3] = { ts.planes[TriangleSetup::L1], ts.planes[TriangleSetup::L2], ts.edge0() };
+        const int T = RASTER_TILE, txbase = xmin & ~(T-1), ntx = (xmax - txbase)/T + 1;
+        static thread_local std::vector<char> inside;
+        inside.resize(ntx);
+        for (int ty=ymin & ~(T-1); ty<=ymax; ty+=T) {
+            int y0 = std::max(ty, ymin), y1 = std::min(ty + T - 1, ymax);
+            for (int i=0; i<ntx; i++) {
+                int x0 = std::max(txbase + i*T, xmin), x1 = std::min(txbase + i*T + T - 1, xmax);
+                bool outside = false;
+                for (int e=0; e<3 && !outside; e++) {
+                    const Plane &p = edges[e];
+                    outside = p.a + p.dx*(p.dx > 0 ? x1 : x0) + p.dy*(p.dy > 0 ? y1 : y0) < -EDGE_EPS;
+                }
+                inside[i] = !outside;
+            }
+            for (int y=y0; y<=y1; y++) {
+                raster.begin_row(y);
+                for (int i=0; i<ntx; ) {
+                    if (!inside[i]) { i++; continue; }
+                    int j = i;
+                    while (j+1<ntx && inside[j+1]) j++;
+                    raster.span(y, std::max(txbase + i*T, xmin), std::min(txbase + j*T + T - 1, xmax));
+                    i = j + 1;
+                }
+            }
+        }
+    }
+    raster.flush();
+    if (timed) {
+        profiler::add_time("raster", profiler::now() - t_begin - raster.t_frag);
+        profiler::add_time("fragment", raster.t_frag);
+        profiler::count("fragments", raster.nfrag);
+        profiler::count(kind, 1);
+        profiler::count("coverage_tests", raster.ntested);
+    }
+}
+
+// 只写深度的光栅化，用于阴影贴图等 pass：没有 varying、没有颜色写入，也没有逐像素的虚函数调用
+// conservative 为 true 时深度取像素范围内最远的值，用于遮挡缓冲：写入的深度不会比真实表面更近
+// （覆盖仍按像素中心判断；逐三角形的"完全覆盖"判断会在共享边上留下缝隙，遮挡测试方改为把包围盒外扩一个像素）
+inline void triangle_depth(const Vec4f *clip, float *zbuffer, int width, int height, bool conservative=false) {
+    Vec3f pts[3];
+    for (int i=0; i<3; i++) pts[i] = Vec3f(clip[i].x/clip[i].w, clip[i].y/clip[i].w, clip[i].z/clip[i].w);
+    float e1x = pts[1].x - pts[0].x, e1y = pts[1].y - pts[0].y;
+    float e2x = pts[2].x - pts[0].x, e2y = pts[2].y - pts[0].y;
+    float area = e1x*e2y - e2x*e1y;
+    if (std::abs(area) < 1e-6f) return;
+    float inv = 1.f/area;
+
+    // 只需要 l1, l2, z 三个平面
+    float l1dx =  e2y*inv, l1dy = -e2x*inv;
+    float l2dx = -e1y*inv, l2dy =  e1x*inv;
+    float zdx  = ((pts[1].z-pts[0].z)*e2y - (pts[2].z-pts[0].z)*e1y)*inv;
+    float zdy  = ((pts[2].z-pts[0].z)*e1x - (pts[1].z-pts[0].z)*e2x)*inv;
+
+    // 线性函数在以像素中心为中心的单位正方形上的最小值 = 中心值 - (|dx|+|dy|)/2
+    float mz = conservative ? .5f*(std::abs(zdx) + std::abs(zdy)) : 0.f;
+
+    int xmin = std::max(0,        (int)std::floor(std::min({pts[0].x, pts[1].x, pts[2].x})));
+    int ymin = std::max(0,        (int)std::floor(std::min({pts[0].y, pts[1].y, pts[2].y})));
+    int xmax = std::min(width-1,  (int)std::ceil (std::max({pts[0].x, pts[1].x, pts[2].x})));
+    int ymax = std::min(height-1, (int)std::ceil (std::max({pts[0].y, pts[1].y, pts[2].y})));
+
+    for (int y=ymin; y<=ymax; y++)
+    {
+        float dx0 = xmin - pts[0].x, dy0 = y - pts[0].y;
+        float l1 = l1dx*dx0 + l1dy*dy0;
+        float l2 = l2dx*dx0 + l2dy*dy0;
+        float z  = pts[0].z + zdx*dx0 + zdy*dy0 - mz;
+        float *row = zbuffer + y*width;
+        for (int x=xmin; x<=xmax; x++, l1+=l1dx, l2+=l2dx, z+=zdx)
+        {
+            if (l1 >= -EDGE_EPS && l2 >= -EDGE_EPS && l1 + l2 <= 1 + EDGE_EPS && row[x] < z)
+                row[x] = z;
         }
     }
 }
 
-#endif //__GL_H__
\ No newline at end of file
+// 阴影贴图：从光源视角渲染的深度，片段阶段用 lit() 做一次投影和一次查表
+struct ShadowMap {
+    int w = 0, h = 0;
+    std::vector<float> depth;
+    mat<4,4,float> transform;           // 世界坐标 -> 光源屏幕坐标，即光源的 Viewport*Projection*ModelView
+
+    ShadowMap(int w, int h) : w(w), h(h), depth(w*h, -std::numeric_limits<float>::max()) {}
+
+    void clear() {
+        std::fill(depth.begin(), depth.end(), -std::numeric_limits<float>::max());
+    }
+
+    // 光栅化一个世界坐标的三角面
+    void draw(const Vec3f *verts) {
+        draw(verts, identity<4>());
+    }
+
+    // 光栅化一个模型坐标的三角面，M 为它的模型矩阵（与着色器 bind 的 M 相同）
+    void draw(const Vec3f *verts, const mat<4,4,float> &M) {
+        const mat<4,4,float> T = transform*M;
+        Vec4f clip[3];
+        for (int i=0; i<3; i++) clip[i] = T*Vec4f(verts[i].x, verts[i].y, verts[i].z, 1);
+        triangle_depth(clip, depth.data(), w, h);
+    }
+
+    // p 为世界坐标（着色器里 uniform_M 变换后的位置）；返回 1 表示受光，0 表示在阴影中；bias 用于消除自阴影条纹
+    float lit(Vec3f p, float bias=0.02f) const {
+        Vec4f s = transform*Vec4f(p.x, p.y, p.z, 1);
+        int x = s.x/s.w, y = s.y/s.w;
+        if (x<0 || y<0 || x>=w || y>=h) return 1.f;
+        return s.z/s.w + bias >= depth[x + y*w] ? 1.f : 0.f;
+    }
+};
+
+#endif //__GL_H__
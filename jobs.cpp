@@ -0,0 +1,266 @@
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "jobs.h"
+
+namespace jobs {
+
+namespace {
+
+// level 为提交方的嵌套深度加一：在深度 d 上等待的线程只执行 level > d 的任务，
+// 否则等待方可能接手一个与自己同级、反过来又要等自己完成的任务（例如两个请求等同一个模型的加载），在同一个栈上死锁
+struct Task {
+    Job job;
+    int level;
+};
+
+struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+thread_local int tls_worker = -1;
+thread_local int tls_depth = 0;
+
+class Scheduler {
+public:
+    explicit Scheduler(const Options &options) {
+        int n = options.threads > 0 ? options.threads : std::max(1, int(std::thread::hardware_concurrency()) - 1);
+        for (int i=0; i<n; i++) queues_.push_back(std::make_unique<Queue>());
+        std::vector<int> cpus = allowed_cpus();
+        for (int i=0; i<n; i++) {
+            threads_.emplace_back([this, i] { run(i); });
+            if (options.pin && !cpus.empty()) pin(threads_.back(), cpus[i % cpus.size()]);
+        }
+    }
+
+    // 进程退出时执行完剩余的任务
+    ~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &t : threads_) t.join();
+    }
+
+    int size() const { return (int)queues_.size(); }
+
+    void submit(Job job) {
+        Queue &q = tls_worker >= 0 ? *queues_[tls_worker] : injector_;
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(Task{std::move(job), tls_depth + 1});
+        }
+        queued_.fetch_add(1, std::memory_order_release);
+        // 先计数再取锁通知：睡眠方在锁内检查计数，不会错过唤醒
+        { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+        wake_.notify_one();
+    }
+
+    // 取一个 level 不小于 min_level 的任务执行；没有时返回 false
+    bool try_run(int min_level) {
+        Task task;
+        if (!pop(task, min_level)) return false;
+        int depth = tls_depth;
+        tls_depth = task.level;
+        task.job();
+        tls_depth = depth;
+        return true;
+    }
+
+private:
+    std::vector<std::unique_ptr<Queue> > queues_;
+    Queue injector_;
+    std::vector<std::thread> threads_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<int> queued_ = 0;
+    bool stop_ = false;
+
+    bool pop(Task &task, int min_level) {
+        if (queued_.load(std::memory_order_acquire)==0) return false;
+        int self = tls_worker;
+        if (self >= 0 && take(*queues_[self], task, true, min_level)) return true;
+        if (take(injector_, task, false, min_level)) return true;
+        // 从下一个线程开始轮流偷，避免所有空闲线程挤在同一个队列上
+        int n = size();
+        for (int k=1; k<=n; k++) {
+            int victim = (std::max(self, 0) + k) % n;
+            if (victim!=self && take(*queues_[victim], task, false, min_level)) return true;
+        }
+        return false;
+    }
+
+    // 自己的队列从队尾找，偷的时候从队首找，取第一个 level 符合的任务
+    bool take(Queue &q, Task &task, bool back, int min_level) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        int n = q.tasks.size();
+        for (int k=0; k<n; k++) {
+            auto it = q.tasks.begin() + (back ? n-1-k : k);
+            if (it->level < min_level) continue;
+            task = std::move(*it);
+            q.tasks.erase(it);
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void run(int index) {
+        tls_worker = index;
+        for (;;) {
+            if (try_run(0)) continue;
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_.wait(lock, [this] { return stop_ || queued_.load(std::memory_order_acquire) > 0; });
+            if (stop_ && queued_.load(std::memory_order_acquire)==0) return;
+        }
+    }
+
+    static std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set)==0)
+            for (int c=0; c<CPU_SETSIZE; c++)
+                if (CPU_ISSET(c, &set)) cpus.push_back(c);
+#endif
+        return cpus;
+    }
+
+    static void pin(std::thread &t, int cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(t.native_handle(), sizeof(set), &set))
+            std::cerr << "can't pin worker to cpu " << cpu << std::endl;
+#endif
+    }
+};
+
+std::mutex init_mutex;
+Options init_options;
+std::atomic<Scheduler *> instance = NULL;
+
+Scheduler &scheduler() {
+    Scheduler *s = instance.load(std::memory_order_acquire);
+    if (s) return *s;
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (!instance.load(std::memory_order_relaxed)) {
+        static std::unique_ptr<Scheduler> owner;             // 静态析构时回收工作线程
+        owner = std::make_unique<Scheduler>(init_options);
+        instance.store(owner.get(), std::memory_order_release);
+    }
+    return *instance.load(std::memory_order_relaxed);
+}
+
+}
+
+bool init(const Options &options) {
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (instance.load(std::memory_order_relaxed)) return false;
+    init_options = options;
+    return true;
+}
+
+int nthreads() {
+    return scheduler().size();
+}
+
+bool running() {
+    return instance.load(std::memory_order_acquire) != NULL;
+}
+
+int worker_index() {
+    return tls_worker;
+}
+
+void submit(Job job) {
+    scheduler().submit(std::move(job));
+}
+
+void help_until(const std::function<bool()> &done) {
+    Scheduler &s = scheduler();
+    for (int idle=0; !done(); ) {
+        if (s.try_run(tls_depth + 1)) {
+            idle = 0;
+            continue;
+        }
+        // 等的任务正在别的线程上执行：先让出时间片，等久了再睡眠，睡眠时间逐步加长到 0.5ms，不空转占满一个核
+        if (++idle < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(std::min(500, 10 << std::min(idle - 64, 6))));
+    }
+}
+
+void TaskGroup::run(Job job) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    submit([this, job = std::move(job)] {
+        try {
+            job();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+        pending_.fetch_sub(1, std::memory_order_release);    // 之后不能再访问 this，等待方可能已经返回
+    });
+}
+
+void TaskGroup::wait() {
+    help_until([this] { return pending_.load(std::memory_order_acquire)==0; });
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)> &fn) {
+    int n = end - begin;
+    grain = std::max(1, grain);
+    if (n <= grain) {
+        if (n > 0) fn(begin, end);
+        return;
+    }
+    // 段数取线程数的几倍，让先做完的线程还能偷到活
+    int nchunks = std::min((n + grain - 1)/grain, 4*(nthreads() + 1));
+    TaskGroup group;
+    for (int c=1; c<nchunks; c++) {
+        int b = begin + int(std::int64_t(n)*c/nchunks), e = begin + int(std::int64_t(n)*(c+1)/nchunks);
+        group.run([&fn, b, e] { fn(b, e); });
+    }
+    fn(begin, begin + int(std::int64_t(n)/nchunks));
+    group.wait();
+}
+
+int TaskGraph::add(Job job, std::initializer_list<int> deps) {
+    nodes_.push_back(std::make_unique<Node>());
+    nodes_.back()->job = std::move(job);
+    nodes_.back()->ndeps = deps.size();
+    int id = nodes_.size() - 1;
+    for (int d : deps) nodes_[d]->next.push_back(id);
+    return id;
+}
+
+void TaskGraph::launch(int i, TaskGroup &group) {
+    group.run([this, i, &group] {
+        nodes_[i]->job();
+        for (int s : nodes_[i]->next)
+            if (nodes_[s]->pending.fetch_sub(1, std::memory_order_acq_rel)==1) launch(s, group);
+    });
+}
+
+void TaskGraph::run() {
+    for (std::unique_ptr<Node> &node : nodes_) node->pending.store(node->ndeps, std::memory_order_relaxed);
+    TaskGroup group;
+    for (int i=0; i<(int)nodes_.size(); i++)
+        if (!nodes_[i]->ndeps) launch(i, group);
+    group.wait();
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+
+// 进程内共享的工作窃取线程池，OBJ 解析、纹理解码、切线计算、TGA 编码和渲染服务的请求都在这里执行，不再各自开线程
+// 每个工作线程一个双端队列：自己从队尾取（后进先出，数据还在缓存里），空闲时从别的线程的队首偷（偷到的是较早、通常较大的任务）
+// 等待任务完成的线程不阻塞，而是一边等一边执行队列里比自己嵌套更深的任务，所以嵌套的 parallel_for 既不会死锁也不会多开线程
+namespace jobs {
+
+typedef std::function<void()> Job;
+
+struct Options {
+    int  threads = 0;                   // 工作线程数；0 为硬件线程数减一，等待中的调用线程补上最后一个核
+    bool pin = false;                   // 工作线程 i 绑定到进程可用的第 i 个 CPU，避免在 NUMA 节点间迁移
+};
+
+// 须在第一次提交任务之前调用；线程池已经启动时返回 false
+bool init(const Options &options);
+int  nthreads();
+// 线程池是否已经启动（第一次提交任务或调用 nthreads 时启动）
+bool running();
+// 当前线程的工作线程编号，不是工作线程时为 -1
+int  worker_index();
+
+// 提交一个任务；工作线程提交的任务进自己的队列，其他线程提交的进共享的入口队列
+void submit(Job job);
+// 执行队列里的任务直到 done() 为真；只执行嵌套层级比当前任务更深的任务，见 jobs.cpp 中的 Task
+void help_until(const std::function<bool()> &done);
+
+// 一组任务的完成计数；任务抛出的第一个异常在 wait() 中重新抛出
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup& operator=(const TaskGroup &) = delete;
+    ~TaskGroup() { help_until([this] { return pending_.load(std::memory_order_acquire)==0; }); }
+
+    void run(Job job);
+    void wait();
+
+private:
+    std::atomic<int> pending_ = 0;
+    std::mutex mutex_;
+    std::exception_ptr error_;
+};
+
+// 把 [begin, end) 切成不小于 grain 的段并行执行 fn(段首, 段尾)，调用线程也参与
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)> &fn);
+
+// 在线程池里执行 fn，结果用 wait() 取
+template<typename F> auto async(F fn) -> std::shared_future<decltype(fn())> {
+    typedef decltype(fn()) R;
+    auto task = std::make_shared<std::packaged_task<R()> >(std::move(fn));
+    std::shared_future<R> f = task->get_future().share();
+    submit([task] { (*task)(); });
+    return f;
+}
+
+// 等 future 就绪，等待期间执行别的任务；std::launch::deferred 的 future 直接在当前线程求值
+template<typename T> const T &wait(const std::shared_future<T> &f) {
+    help_until([&f] { return f.wait_for(std::chrono::seconds(0)) != std::future_status::timeout; });
+    return f.get();
+}
+
+// 有依赖关系的任务图：add 返回节点编号，deps 为先行节点的编号；run 时依赖都完成的节点并行执行
+class TaskGraph {
+public:
+    int add(Job job, std::initializer_list<int> deps = {});
+    // 执行所有节点并等待完成，可以重复执行
+    void run();
+
+private:
+    struct Node {
+        Job job;
+        std::vector<int> next;
+        int ndeps = 0;
+        std::atomic<int> pending = 0;
+    };
+    std::vector<std::unique_ptr<Node> > nodes_;
+
+    void launch(int i, TaskGroup &group);
+};
+
+}
+
+#endif //__JOBS_H__
@@ -1,74 +1,222 @@
-#include "gl.h"
-#include "model.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include "render.h"
+#include "shaders.h"
+#include "objstream.h"
+#include "bands.h"
+#include "sortlast.h"
+#include "sequence.h"
 
 Model *model     = NULL;
-const int width  = 800;
-const int height = 800;
+int width       = 800;
+int height      = 800;
 
 Vec3f  light_dir(1,1,1);
 Vec3f camera_pos(1,1,3);
 Vec3f     center(0,0,0);
 Vec3f         up(0,1,0);
 
-struct GouraudShader : public IShader {
-    Vec3f varying_intensity;
-
-    virtual Vec4f vertex(Vec3f vert, Vec3f normal, int ivert) {
-        varying_intensity[ivert] = std::max(0.f, normal*light_dir);
-         Vec4f v = Viewport*Projection*ModelView*Vec4f(vert.x, vert.y, vert.z, 1);
-        // return Viewport*Projection*ModelView*v;
-        return v/v.w;
-    }
+// 主相机，视口占图像中央 3/4
+void set_camera() {
+    set_modelview(camera_pos, center, up);                      // TODO 视图矩阵推导
+    set_projection(-1.f/norm(camera_pos-center));               // TODO 透视矩阵推导
+    set_viewport(width/8, height/8, width*3/4, height*3/4);     // TODO 视口矩阵推导
+}
 
-    virtual bool fragment(Vec3f bc, Vec2f uvf, TGAColor &color) {
-        float intensity = varying_intensity*bc;
-        // color = model->diffuse(uvf);
-        color = TGAColor{255,255,255}*intensity;
-        return false;
-    }
-};
+// 阴影 pass：从光源方向做正交投影，只写深度；会改写全局相机
+void draw_shadow(Model &mesh, ShadowMap &shadow) {
+    PROFILE_SCOPE("shadow_pass");
+    set_modelview(light_dir, center, up);
+    set_projection(0);
+    set_viewport(shadow.w/8, shadow.h/8, shadow.w*3/4, shadow.h*3/4);
+    shadow.transform = Viewport*Projection*ModelView;
+    draw_model_shadow(mesh, shadow, identity<4>());
+}
 
 int main(int argc, char** argv) {
 
-    if (argc == 2) {
-        model = new Model(argv[1]);
-    } else {
-        model = new Model("../obj/african_head.obj");
+    const char *filename = "../obj/african_head.obj";
+    size_t stream_budget = 0;                                   // 非 0 时走流式渲染，单位字节
+    const char *trace = NULL;                                   // 非空时开启分阶段计时，结束后写出 Chrome trace
+    ShadingRate rate = ShadingRate::R1x1;                       // 整个 draw 的着色率
+    const char *rate_file = NULL;                               // 逐 16x16 块的着色率图，见 RateImage::from_image
+    bool compact = false;                                       // 量化的紧凑顶点存储，见 CompactMesh
+    size_t band_budget = 0;                                     // 非 0 时分带渲染，颜色和深度缓冲共用的字节数，见 bands.h
+    int workers = 0;                                            // 大于 1 时 sort-last 多进程渲染，见 sortlast.h
+    int turntable = 0;                                          // 非 0 时相机绕 up 轴转一圈，画这么多帧
+    const char *sequence = NULL;                                // 转台帧写入这个帧序列容器（见 sequence.h），否则逐帧写 out_NNNN.tga
+    std::string lod_cache;                                      // 非空时 LOD 缓存在这个目录里，否则每次重新简化
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--stream") && i+1<argc) stream_budget = size_t(atol(argv[++i]))<<20;
+        else if (!strcmp(argv[i], "--profile") && i+1<argc) trace = argv[++i];
+        else if (!strcmp(argv[i], "--rate") && i+1<argc) {
+            if (!parse_shading_rate(argv[++i], rate)) {
+                std::cerr << "bad shading rate " << argv[i] << ", expected 1x1, 1x2, 2x2 or 4x4\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--rate-image") && i+1<argc) rate_file = argv[++i];
+        else if (!strcmp(argv[i], "--size") && i+1<argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height)!=2 || width<=0 || height<=0) {
+                std::cerr << "bad size " << argv[i] << ", expected WxH\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--compact")) compact = true;
+        else if (!strcmp(argv[i], "--bands") && i+1<argc) band_budget = size_t(atol(argv[++i]))<<20;
+        else if (!strcmp(argv[i], "--workers") && i+1<argc) workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--turntable") && i+1<argc) turntable = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--sequence") && i+1<argc) sequence = argv[++i];
+        else if (!strcmp(argv[i], "--lod-cache") && i+1<argc) lod_cache = argv[++i];
+        else if (argv[i][0]=='-') {
+            std::cerr << "unknown option " << argv[i] << "\n";
+            return 1;
+        }
+        else filename = argv[i];
     }
-
-    set_modelview(camera_pos, center, up);                      // TODO 视图矩阵推导
-    set_projection(-1.f/norm(camera_pos-center));               // TODO 透视矩阵推导
-    set_viewport(width/8, height/8, width*3/4, height*3/4);     // TODO 视口矩阵推导
+    if ((stream_budget!=0) + (band_budget!=0) + (workers>1) > 1) {
+        std::cerr << "--stream, --bands and --workers can't be combined\n";
+        return 1;
+    }
+    if (!std::ifstream(filename)) {
+        std::cerr << "can't open " << filename << "\n";
+        return 1;
+    }
+    if (sequence && turntable <= 0) turntable = 360;
+    if (turntable > 0 && (stream_budget || band_budget || workers > 1)) {
+        std::cerr << "--turntable can't be combined with --stream, --bands or --workers\n";
+        return 1;
+    }
+    if (trace) profiler::enable(true);
 
     light_dir = normalized(light_dir);
 
-    TGAImage image(width, height, TGAImage::RGB);
-    float* zbuffer = new float[height*width];
-    for (int i=0; i<height*width; i++) {
-        zbuffer[i] = -std::numeric_limits<float>::max();
-    }
+    // 分带渲染时不分配整幅的颜色和深度缓冲；sort-last 时深度缓冲在工作进程里
+    TGAImage image(band_budget ? 0 : width, band_budget ? 0 : height, TGAImage::RGB);
+    std::vector<float> zbuffer(band_budget || workers > 1 ? 0 : size_t(width)*height, -std::numeric_limits<float>::max());
+    // 阴影贴图分辨率不超过 4096，大图不为阴影贴图占用整幅的内存
+    const int shadow_w = std::min(width, 4096), shadow_h = std::min(height, 4096);
 
-    GouraudShader shader;
-    for (int i=0; i<model->nfaces(); i++) {                 // 遍历三角面
-        Vec4f screen_coords[3];
-        for (int j=0; j<3; j++) {                           // 遍历三角面顶点
-            screen_coords[j] = shader.vertex(               // 返回屏幕坐标
-                model->vert(model->face(i)[j]),
-                model->normal(i, j),
-                j
-            );           
+    std::int64_t frame_begin = profiler::now();
+    if (stream_budget) {
+        // 超出内存的网格：不建立 Model，面按块读出直接光栅化，没有 LOD 和阴影
+        set_camera();
+        GouraudShader shader(light_dir);
+        stream_render(filename, stream_budget, shader, image, zbuffer.data());
+    } else if (workers > 1) {
+        // sort-last：每个工作进程只加载自己那份面，阴影贴图和最终图像都按深度合成；各进程的面数不同，不选 LOD
+        // 工作进程在 fork 之后才启动各自的线程池，这之前协调进程不能用线程池（包括读着色率图）
+        bool ok = run_sort_last(workers, width, height, TGAImage::RGB, image, [&](SortLastWorker &worker) {
+            ModelOptions options;
+            options.textures = TextureLoad::Lazy;
+            options.compact_vertices = compact;
+            options.part = worker.index();
+            options.nparts = worker.count();
+            Model part(filename, options);
+
+            ShadowMap shadow(shadow_w, shadow_h);
+            draw_shadow(part, shadow);
+            if (!worker.composite(NULL, shadow.depth.data(), shadow.w, shadow.h)) return false;
+            set_camera();
+
+            GouraudShader shader(light_dir, &shadow);
+            RateImage rates;
+            TGAImage rate_img;
+            shader.rate = rate;
+            if (rate_file) {
+                if (!rate_img.read_tga_file(rate_file)) return false;
+                rates = RateImage::from_image(rate_img);
+                shader.rates = &rates;
+            }
+            TGAImage part_image(width, height, TGAImage::RGB);
+            std::vector<float> part_zbuffer(size_t(width)*height, -std::numeric_limits<float>::max());
+            {
+                PROFILE_SCOPE("draw");
+                draw_model(part, shader, part_image, part_zbuffer.data());
+            }
+            return worker.composite(&part_image, part_zbuffer.data(), width, height);
+        });
+        if (!ok) {
+            std::cerr << "sort-last rendering failed\n";
+            return 1;
+        }
+    } else {
+        // GouraudShader 不采样任何纹理，用 Lazy 让纹理 I/O 不计入首帧时间
+        ModelOptions options;
+        options.textures = TextureLoad::Lazy;
+        options.compact_vertices = compact;
+        model = new Model(filename, options);
+        if (!model->nfaces()) {
+            std::cerr << "can't load " << filename << "\n";
+            delete model;
+            return 1;
         }
 
-        Vec2f uvfs[3];
-        for (int k=0; k<3; k++) {
-            uvfs[k] = model->uv(i, k);
+        // 按屏幕尺寸选 LOD，远处或缩略图渲染只处理简化后的网格
+        set_camera();
+        model->build_lods(4, .5f, lod_cache);
+        Model *mesh = model->lod_for(projected_radius(model->center(), model->radius()));
+
+        ShadowMap shadow(shadow_w, shadow_h);
+        draw_shadow(*mesh, shadow);
+        set_camera();
+
+        GouraudShader shader(light_dir, &shadow);
+        RateImage rates;
+        TGAImage rate_img;
+        shader.rate = rate;
+        if (rate_file) {
+            if (!rate_img.read_tga_file(rate_file)) return 1;
+            rates = RateImage::from_image(rate_img);
+            shader.rates = &rates;
+        }
+        if (band_budget) {
+            PROFILE_SCOPE("draw");
+            if (!render_banded(*mesh, shader, width, height, "out.tga", band_budget)) return 1;
+        } else if (turntable > 0) {
+            // 模型和光源不动，阴影贴图和 LOD 对所有帧都有效；相机到中心的距离不变，只绕 up 轴转
+            SequenceWriter seq;
+            if (sequence && !seq.open(sequence, width, height, TGAImage::RGB)) return 1;
+            const Vec3f start = camera_pos - center;
+            for (int f=0; f<turntable; f++) {
+                float a = 2*float(M_PI)*f/turntable, c = std::cos(a), s = std::sin(a);
+                camera_pos = center + Vec3f(start.x*c + start.z*s, start.y, start.z*c - start.x*s);
+                set_camera();                                   // 着色器没有 bind，draw 时取当前相机
+                image = TGAImage(width, height, TGAImage::RGB);
+                std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<float>::max());
+                {
+                    PROFILE_SCOPE("draw");
+                    draw_model(*mesh, shader, image, zbuffer.data());
+                }
+                image.flip_vertically();
+                char name[32];
+                snprintf(name, sizeof(name), "out_%04d.tga", f);
+                if (sequence ? !seq.add_frame(image) : !image.write_tga_file(name)) return 1;
+            }
+            if (sequence) {
+                if (!seq.close()) return 1;
+                std::cerr << sequence << ": " << seq.frames() << " frames, " << seq.keyframes() << " keyframes, " << seq.bytes() << " bytes\n";
+            }
+        } else {
+            PROFILE_SCOPE("draw");
+            draw_model(*mesh, shader, image, zbuffer.data());
         }
-        triangle(screen_coords, uvfs, shader, image, zbuffer);    // 光栅化
+        delete model;
     }
 
-    image.flip_vertically();
-    image.write_tga_file("out.tga");
+    if (!band_budget && turntable <= 0) {
+        image.flip_vertically();
+        image.write_tga_file("out.tga");
+    }
+
+    if (trace) {
+        profiler::event("frame", frame_begin, profiler::now());
+        if (!profiler::write_chrome_trace(trace)) std::cerr << "can't write " << trace << "\n";
+        profiler::print_summary(std::cerr);
+    }
 
-    delete model;
     return 0;
-}
\ No newline at end of file
+}
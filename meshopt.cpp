@@ -0,0 +1,222 @@
+#include <deque>
+#include <cmath>
+#include <algorithm>
+#include "meshopt.h"
+
+void triangulate(std::vector<std::vector<Vec3i> > &faces) {
+    std::vector<std::vector<Vec3i> > tris;
+    tris.reserve(faces.size());
+    for (const std::vector<Vec3i> &f : faces) {
+        if (f.size()==3) {
+            tris.push_back(f);
+            continue;
+        }
+        for (int i=2; i<(int)f.size(); i++)
+            tris.push_back({f[0], f[i-1], f[i]});
+    }
+    faces.swap(tris);
+}
+
+void optimize_vertex_cache(std::vector<std::vector<Vec3i> > &faces, int nverts, int cache_size) {
+    int nfaces = faces.size();
+    // 顶点 -> 三角形邻接表（CSR 形式）
+    std::vector<int> offset(nverts+1, 0), adj(nfaces*3);
+    for (const std::vector<Vec3i> &f : faces)
+        for (int j=0; j<3; j++) offset[f[j][0]+1]++;
+    for (int v=0; v<nverts; v++) offset[v+1] += offset[v];
+    std::vector<int> live(nverts), fill(offset.begin(), offset.end()-1);
+    for (int t=0; t<nfaces; t++)
+        for (int j=0; j<3; j++) adj[fill[faces[t][j][0]]++] = t;
+    for (int v=0; v<nverts; v++) live[v] = offset[v+1] - offset[v];
+
+    std::vector<int> stamp(nverts, 0), order, deadend, candidates;
+    std::vector<bool> emitted(nfaces, false);
+    order.reserve(nfaces);
+    int time = cache_size + 1, cursor = 0;
+    int fan = nverts ? 0 : -1;
+    while (fan >= 0) {
+        candidates.clear();
+        for (int k=offset[fan]; k<offset[fan+1]; k++) {
+            int t = adj[k];
+            if (emitted[t]) continue;
+            for (int j=0; j<3; j++) {
+                int v = faces[t][j][0];
+                deadend.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - stamp[v] > cache_size) stamp[v] = time++;
+            }
+            emitted[t] = true;
+            order.push_back(t);
+        }
+
+        // 下一个扇心：优先选仍在缓存中、且剩余三角形发射后不会被挤出缓存的顶点
+        int best = -1, priority = -1;
+        for (int v : candidates) {
+            if (live[v] <= 0) continue;
+            int p = 0;
+            if (time - stamp[v] + 2*live[v] <= cache_size) p = time - stamp[v];
+            if (p > priority) { priority = p; best = v; }
+        }
+        // 死胡同：先回退到最近发射过的顶点，再按输入顺序往后找
+        while (best < 0 && !deadend.empty()) {
+            int d = deadend.back();
+            deadend.pop_back();
+            if (live[d] > 0) best = d;
+        }
+        while (best < 0 && cursor < nverts) {
+            if (live[cursor] > 0) best = cursor;
+            cursor++;
+        }
+        fan = best;
+    }
+
+    std::vector<std::vector<Vec3i> > out;
+    out.reserve(nfaces);
+    for (int t : order) out.push_back(faces[t]);
+    faces.swap(out);
+}
+
+namespace {
+
+// 返回被引用的项数，它们排在最前面
+template<typename T> size_t reorder_stream(std::vector<T> &data, std::vector<std::vector<Vec3i> > &faces, int attr) {
+    std::vector<int> remap(data.size(), -1);
+    std::vector<T> out;
+    out.reserve(data.size());
+    for (std::vector<Vec3i> &f : faces) {
+        for (Vec3i &c : f) {
+            int &idx = c[attr];
+            if (idx < 0 || idx >= (int)data.size()) continue;
+            if (remap[idx] < 0) {
+                remap[idx] = out.size();
+                out.push_back(data[idx]);
+            }
+            idx = remap[idx];
+        }
+    }
+    size_t used = out.size();
+    for (int i=0; i<(int)data.size(); i++)
+        if (remap[i] < 0) out.push_back(data[i]);
+    data.swap(out);
+    return used;
+}
+
+template<typename T> void truncate(std::vector<T> &data, size_t n) {
+    data.resize(n);
+    data.shrink_to_fit();
+}
+
+}
+
+void reorder_vertices(std::vector<Vec3f> &verts, std::vector<Vec2f> &uvs, std::vector<Vec3f> &norms, std::vector<std::vector<Vec3i> > &faces) {
+    reorder_stream(verts, faces, 0);
+    reorder_stream(uvs,   faces, 1);
+    reorder_stream(norms, faces, 2);
+}
+
+void extract_faces(std::vector<Vec3f> &verts, std::vector<Vec2f> &uvs, std::vector<Vec3f> &norms, std::vector<std::vector<Vec3i> > &faces, int begin, int end) {
+    begin = std::clamp(begin, 0, (int)faces.size());
+    end = std::clamp(end, begin, (int)faces.size());
+    std::vector<std::vector<Vec3i> >(faces.begin() + begin, faces.begin() + end).swap(faces);
+    truncate(verts, reorder_stream(verts, faces, 0));
+    truncate(uvs,   reorder_stream(uvs,   faces, 1));
+    truncate(norms, reorder_stream(norms, faces, 2));
+}
+
+float acmr(const std::vector<std::vector<Vec3i> > &faces, int nverts, int cache_size) {
+    if (faces.empty()) return 0;
+    std::vector<bool> cached(nverts, false);
+    std::deque<int> fifo;
+    int misses = 0;
+    for (const std::vector<Vec3i> &f : faces) {
+        for (const Vec3i &c : f) {
+            if (cached[c[0]]) continue;
+            misses++;
+            cached[c[0]] = true;
+            fifo.push_back(c[0]);
+            if ((int)fifo.size() > cache_size) {
+                cached[fifo.front()] = false;
+                fifo.pop_front();
+            }
+        }
+    }
+    return float(misses)/faces.size();
+}
+
+namespace {
+
+// 单位向量 -> 八面体上的两个 16 位 snorm，低 16 位为 x
+std::uint32_t encode_octahedral(Vec3f n) {
+    float len = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (len < 1e-20f) return 0;
+    float x = n.x/len, y = n.y/len;
+    if (n.z < 0) {                                          // 下半球沿对角线折到外侧
+        float fx = (1 - std::abs(y))*(x >= 0 ? 1 : -1), fy = (1 - std::abs(x))*(y >= 0 ? 1 : -1);
+        x = fx;
+        y = fy;
+    }
+    auto q = [](float v) { return std::uint16_t(std::int16_t(std::lround(std::clamp(v, -1.f, 1.f)*32767))); };
+    return q(x) | (std::uint32_t(q(y)) << 16);
+}
+
+// 把 [lo, lo + 65535*step] 量化为 16 位；范围为 0 的分量 step 取 0
+float quant_step(float lo, float hi) {
+    return hi > lo ? (hi - lo)/65535.f : 0.f;
+}
+
+std::uint16_t quantize(float v, float lo, float step) {
+    return step > 0 ? std::uint16_t(std::clamp(std::lround((v - lo)/step), 0L, 65535L)) : 0;
+}
+
+}
+
+CompactMesh::CompactMesh(const std::vector<Vec3f> &verts, const std::vector<Vec2f> &uvs_in, const std::vector<Vec3f> &norms, const std::vector<std::vector<Vec3i> > &faces) {
+    Vec3f pmin(0,0,0), pmax(0,0,0);
+    if (!verts.empty()) pmin = pmax = verts[0];
+    for (const Vec3f &v : verts)
+        for (int k=0; k<3; k++) {
+            pmin[k] = std::min(pmin[k], v[k]);
+            pmax[k] = std::max(pmax[k], v[k]);
+        }
+    Vec2f tmin(0,0), tmax(0,0);
+    if (!uvs_in.empty()) tmin = tmax = uvs_in[0];
+    for (const Vec2f &t : uvs_in)
+        for (int k=0; k<2; k++) {
+            tmin[k] = std::min(tmin[k], t[k]);
+            tmax[k] = std::max(tmax[k], t[k]);
+        }
+    pos_min = pmin;
+    uv_min = tmin;
+    for (int k=0; k<3; k++) pos_step[k] = quant_step(pmin[k], pmax[k]);
+    for (int k=0; k<2; k++) uv_step[k] = quant_step(tmin[k], tmax[k]);
+
+    pos.reserve(verts.size()*3);
+    for (const Vec3f &v : verts)
+        for (int k=0; k<3; k++) pos.push_back(quantize(v[k], pos_min[k], pos_step[k]));
+    uvs.reserve(uvs_in.size()*2);
+    for (const Vec2f &t : uvs_in)
+        for (int k=0; k<2; k++) uvs.push_back(quantize(t[k], uv_min[k], uv_step[k]));
+    normals.reserve(norms.size());
+    for (const Vec3f &n : norms) normals.push_back(encode_octahedral(n));
+
+    bool small = std::max({verts.size(), uvs_in.size(), norms.size()}) < 65535;
+    for (const std::vector<Vec3i> &f : faces)
+        for (int j=0; j<3; j++)
+            for (int k=0; k<3; k++) {
+                if (small) index16.push_back(std::uint16_t(f[j][k]));
+                else       index32.push_back(std::uint32_t(f[j][k]));
+            }
+}
+
+void CompactMesh::unpack(std::vector<Vec3f> &verts, std::vector<Vec2f> &uvs_out, std::vector<Vec3f> &norms, std::vector<std::vector<Vec3i> > &faces) const {
+    verts.resize(nverts());
+    for (int i=0; i<nverts(); i++) verts[i] = vert(i);
+    uvs_out.resize(uvs.size()/2);
+    for (int i=0; i<(int)uvs_out.size(); i++) uvs_out[i] = uv(i);
+    norms.resize(normals.size());
+    for (int i=0; i<(int)norms.size(); i++) norms[i] = normal(i);
+    faces.assign(nfaces(), std::vector<Vec3i>(3));
+    for (int c=0; c<nfaces()*3; c++)
+        for (int k=0; k<3; k++) faces[c/3][c%3][k] = index(c, k);
+}
@@ -0,0 +1,72 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include "geometrylix.h"
+
+// 加载时的网格处理；faces 的每个角点为 vertex/uv/normal 下标
+
+// n 边形按扇形拆成三角形，少于 3 个角点的面被丢弃
+void triangulate(std::vector<std::vector<Vec3i> > &faces);
+
+// Tipsify (Sander et al. 2007)：重排三角形顺序以提高变换后顶点缓存的命中率，cache_size 为假定的 FIFO 缓存大小
+void optimize_vertex_cache(std::vector<std::vector<Vec3i> > &faces, int nverts, int cache_size=16);
+
+// 按三角形中第一次被引用的顺序重排各属性数组，使顶点数据的访问基本是顺序的；未被引用的项排在最后
+void reorder_vertices(std::vector<Vec3f> &verts, std::vector<Vec2f> &uvs, std::vector<Vec3f> &norms, std::vector<std::vector<Vec3i> > &faces);
+
+// 只保留第 [begin, end) 个面和它们引用的属性，下标重新编号为首次使用顺序；用于把网格分给多个进程
+void extract_faces(std::vector<Vec3f> &verts, std::vector<Vec2f> &uvs, std::vector<Vec3f> &norms, std::vector<std::vector<Vec3i> > &faces, int begin, int end);
+
+// 平均每个三角形的缓存未命中数 (ACMR)，用 FIFO 缓存模拟
+float acmr(const std::vector<std::vector<Vec3i> > &faces, int nverts, int cache_size=16);
+
+// 量化的紧凑网格（ModelOptions::compact_vertices）：每个顶点位置 6 字节、法线 4 字节、uv 4 字节，
+// 每个角点 3 个 16 位下标（任一属性数组超过 65535 项时为 32 位），代替 Vec3f/Vec2f 属性和 vector<Vec3i> 面表
+// 位置在包围盒内量化为 16 位；法线八面体编码为两个 16 位 snorm；uv 在其包围矩形内量化为 16 位 unorm；在访问时解码
+struct CompactMesh {
+    Vec3f pos_min, pos_step;            // 解码：pos_min + q*pos_step
+    Vec2f uv_min, uv_step;
+    std::vector<std::uint16_t> pos;     // 每个顶点 3 个
+    std::vector<std::uint32_t> normals;
+    std::vector<std::uint16_t> uvs;     // 每个 uv 2 个
+    std::vector<std::uint16_t> index16; // 每个角点 3 个：vertex/uv/normal
+    std::vector<std::uint32_t> index32;
+
+    // faces 须已三角化
+    CompactMesh() = default;
+    CompactMesh(const std::vector<Vec3f> &verts, const std::vector<Vec2f> &uvs, const std::vector<Vec3f> &norms, const std::vector<std::vector<Vec3i> > &faces);
+    // 解码回浮点属性和面表，用于 LOD 简化等需要修改网格的处理
+    void unpack(std::vector<Vec3f> &verts, std::vector<Vec2f> &uvs, std::vector<Vec3f> &norms, std::vector<std::vector<Vec3i> > &faces) const;
+
+    int nverts() const { return pos.size()/3; }
+    int nfaces() const { return (index16.size() + index32.size())/9; }
+    size_t bytes() const { return (pos.size() + uvs.size() + index16.size())*2 + (normals.size() + index32.size())*4; }
+
+    // 缺失的下标（-1）存为全 1
+    int index(int corner, int attr) const {
+        if (index16.empty()) return int(index32[corner*3 + attr]);
+        std::uint16_t i = index16[corner*3 + attr];
+        return i==0xffff ? -1 : i;
+    }
+    Vec3f vert(int i) const {
+        const std::uint16_t *q = &pos[i*3];
+        return Vec3f(pos_min.x + q[0]*pos_step.x, pos_min.y + q[1]*pos_step.y, pos_min.z + q[2]*pos_step.z);
+    }
+    Vec2f uv(int i) const {
+        return Vec2f(uv_min.x + uvs[i*2]*uv_step.x, uv_min.y + uvs[i*2+1]*uv_step.y);
+    }
+    // 已归一化
+    Vec3f normal(int i) const {
+        std::uint32_t e = normals[i];
+        float x = std::int16_t(e & 0xffff)/32767.f, y = std::int16_t(e >> 16)/32767.f;
+        float z = 1 - std::abs(x) - std::abs(y);
+        float t = std::max(-z, 0.f);                    // 下半球折回
+        x += x >= 0 ? -t : t;
+        y += y >= 0 ? -t : t;
+        return normalized(Vec3f(x, y, z));
+    }
+};
+
+#endif //__MESHOPT_H__
@@ -1,107 +1,738 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <filesystem>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
 #include "model.h"
+#include "simplify.h"
+#include "meshopt.h"
+#include "profiler.h"
+#include "jobs.h"
+#include "sampler.h"
 
-Model::Model(const char *filename) : verts_(), faces_(), norms_(), uv_(), diffusemap_(), normalmap_(), specularmap_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
+Model::Model() : verts_(), faces_(), norms_(), uv_(), diffusemap_(), normalmap_(), specularmap_(), tangentmap_(), ambientmap_(), diffuseblocks_(), normalblocks_(), specularblocks_(), tangentblocks_(), ambientblocks_(), compressed_(false), filename_(), bbmin_(), bbmax_(), base_(NULL), lods_(), clusters_(), tangent_index_(), tangents_(), bitangents_(), compact_(false), packed_(), partial_(false) {}
+
+Model::Model(const char *filename, const ModelOptions &options) : Model() {
+    filename_ = filename;
+    compressed_ = options.compress_textures;
+    partial_ = options.nparts > 1;
+    // 先发起纹理加载，Async 模式下解码与 OBJ 解析并行
+    // _nm.tga 是模型空间法线，z 可以为负，不能用只存 x、y 的 BC5
+    load_texture(filename, "_diffuse.tga", options, BlockFormat::BC1, diffusemap_,  diffuseblocks_);
+    load_texture(filename, "_nm.tga",      options, BlockFormat::BC1, normalmap_,   normalblocks_);
+    load_texture(filename, "_spec.tga",    options, BlockFormat::BC4, specularmap_, specularblocks_);
+    load_texture(filename, "_nm_tangent.tga", options, BlockFormat::BC5, tangentmap_, tangentblocks_);
+    load_texture(filename, "_ao.tga",      options, BlockFormat::BC4, ambientmap_,  ambientblocks_);
+    // 网格优化之后，包围盒和切线互不依赖，可以同时计算
+    jobs::TaskGraph graph;
+    int mesh = graph.add([this, filename, &options] {
+        if (partial_) load_obj_part(filename, options.part, options.nparts);
+        else load_obj(filename);
+        if (options.optimize_mesh) {
+            PROFILE_SCOPE("mesh_optimize");
+            float before = acmr(faces_, nverts());
+            optimize_vertex_cache(faces_, nverts());
+            reorder_vertices(verts_, uv_, norms_, faces_);
+            std::cerr << "# acmr " << before << " -> " << acmr(faces_, nverts()) << std::endl;
+        }
+    });
+    graph.add([this] { compute_bounds(); }, {mesh});
+    if (options.tangents) {
+        graph.add([this, filename] {
+            if (!nfaces()) return;
+            std::string name(filename);
+            compute_tangents(partial_ ? std::string() : name.substr(0, name.find_last_of(".")) + "_tangents.bin");
+        }, {mesh});
+    }
+    graph.run();
+    if (options.compact_vertices) compact();
+}
+
+void Model::compact() {
+    if (faces_.empty()) return;
+    size_t before = (verts_.size() + norms_.size())*sizeof(Vec3f) + uv_.size()*sizeof(Vec2f) +
+                    faces_.size()*(sizeof(std::vector<Vec3i>) + 3*sizeof(Vec3i));
+    packed_ = CompactMesh(verts_, uv_, norms_, faces_);
+    compact_ = true;
+    std::vector<Vec3f>().swap(verts_);
+    std::vector<Vec3f>().swap(norms_);
+    std::vector<Vec2f>().swap(uv_);
+    std::vector<std::vector<Vec3i> >().swap(faces_);
+    std::cerr << "# vertex storage " << before << " -> " << packed_.bytes() << " bytes" << std::endl;
+}
+
+namespace {
+
+// OBJ 文件按行切成的一段；各段并行解析后按顺序拼接，面的下标是整个文件的绝对下标，与分段无关
+struct ObjChunk {
+    std::vector<Vec3f> verts, norms;
+    std::vector<Vec2f> uvs;
+    std::vector<std::vector<Vec3i> > faces;
+};
+
+void parse_obj_line(const std::string &line, ObjChunk &out) {
+    std::istringstream iss(line.c_str());
+    char trash;
+    if (!line.compare(0, 2, "v ")) {
+        iss >> trash;
+        Vec3f v;
+        for (int i=0;i<3;i++) iss >> v[i];
+        out.verts.push_back(v);
+    } else if (!line.compare(0, 3, "vn ")) {
+        iss >> trash >> trash;
+        Vec3f n;
+        for (int i=0;i<3;i++) iss >> n[i];
+        out.norms.push_back(n);
+    } else if (!line.compare(0, 3, "vt ")) {
+        iss >> trash >> trash;
+        Vec2f uv;
+        for (int i=0;i<2;i++) iss >> uv[i];
+        out.uvs.push_back(uv);
+    }  else if (!line.compare(0, 2, "f ")) {
+        std::vector<Vec3i> f;
+        Vec3i tmp;
+        iss >> trash;
+        while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
+            for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
+            f.push_back(tmp);
+        }
+        out.faces.push_back(f);
+    }
+}
+
+void parse_obj_lines(const char *begin, const char *end, ObjChunk &out) {
+    std::string line;
+    while (begin < end) {
+        const char *eol = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+        if (!eol) eol = end;
+        line.assign(begin, eol);
+        begin = eol < end ? eol+1 : end;
+        parse_obj_line(line, out);
+    }
+}
+
+// 多边形按 triangulate 的扇形拆分后的三角面数
+int ntriangles(int ncorners) {
+    return ncorners==3 ? 1 : std::max(0, ncorners - 2);
+}
+
+// 面行的角点数，不建立面；只认全部为 v/vt/vn 整数三元组的行，此时与 parse_obj_line 解析出的个数相同，其它写法返回 -1
+int count_corners(const std::string &line) {
+    int n = 0;
+    const char *p = line.c_str() + 2;
+    for (;;) {
+        while (*p==' ' || *p=='\t' || *p=='\r') p++;
+        if (!*p) return n;
+        for (int i=0; i<3; i++) {
+            if (*p=='-') p++;
+            if (!std::isdigit((unsigned char)*p)) return -1;
+            while (std::isdigit((unsigned char)*p)) p++;
+            if (i<2 && *p++!='/') return -1;
+        }
+        if (*p && *p!=' ' && *p!='\t' && *p!='\r') return -1;
+        n++;
+    }
+}
+
+// 网格内容的 FNV-1a 散列，用于校验磁盘缓存：顶点、uv、法线下标和坐标任何一个变了结果都不同
+std::uint64_t mesh_hash(const std::vector<Vec3f> &verts, const std::vector<Vec2f> &uvs, const std::vector<Vec3f> &norms, const std::vector<std::vector<Vec3i> > &faces) {
+    std::uint64_t hash = 1469598103934665603ull;
+    auto mix = [&hash](const void *data, size_t bytes) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i=0; i<bytes; i++) hash = (hash ^ p[i])*1099511628211ull;
+    };
+    for (const std::vector<Vec3i> &f : faces) mix(f.data(), f.size()*sizeof(Vec3i));
+    mix(verts.data(), verts.size()*sizeof(Vec3f));
+    mix(uvs.data(), uvs.size()*sizeof(Vec2f));
+    mix(norms.data(), norms.size()*sizeof(Vec3f));
+    return hash;
+}
+
+template<typename T> void append(std::vector<T> &dst, std::vector<T> &src) {
+    dst.insert(dst.end(), std::make_move_iterator(src.begin()), std::make_move_iterator(src.end()));
+}
+
+}
+
+void Model::load_obj(const char *filename) {
+    PROFILE_SCOPE("obj_parse");
+    std::ifstream in(filename, std::ios::binary);
     if (in.fail()) return;
+    in.seekg(0, std::ios::end);
+    std::string text(size_t(in.tellg()), '\0');
+    in.seekg(0);
+    in.read(text.data(), text.size());
+
+    // 约 1MB 一段，段尾对齐到行尾
+    const size_t CHUNK = size_t(1) << 20;
+    std::vector<size_t> cuts(1, 0);
+    while (cuts.back() < text.size()) {
+        size_t eol = text.find('\n', std::min(text.size(), cuts.back() + CHUNK));
+        cuts.push_back(eol==std::string::npos ? text.size() : eol+1);
+    }
+    std::vector<ObjChunk> chunks(cuts.size()-1);
+    jobs::parallel_for(0, chunks.size(), 1, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) parse_obj_lines(text.data() + cuts[i], text.data() + cuts[i+1], chunks[i]);
+    });
+    for (ObjChunk &c : chunks) {
+        append(verts_, c.verts);
+        append(norms_, c.norms);
+        append(uv_, c.uvs);
+        append(faces_, c.faces);
+    }
+    triangulate(faces_);                // 渲染器按三个角点处理每个面
+    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
+}
+
+void Model::load_obj_part(const char *filename, int part, int nparts) {
+    PROFILE_SCOPE("obj_parse");
+    std::ifstream in(filename, std::ios::binary);
+    if (in.fail()) return;
+
+    // 第一遍：三角面总数，确定本片在整个模型的三角面序列中的范围，与整体加载后 extract_faces 的划分相同；
+    // 每 4096 个面行记一个检查点（行首的文件偏移和之前的三角面数），第二遍从范围前最近的检查点开始读
+    const int CHECKPOINT = 4096;
+    std::vector<std::pair<std::streamoff, std::int64_t> > checkpoints;
     std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Vec3f v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            Vec3f n;
-            for (int i=0;i<3;i++) iss >> n[i];
-            norms_.push_back(n);
-        } else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            Vec2f uv;
-            for (int i=0;i<2;i++) iss >> uv[i];
-            uv_.push_back(uv);
-        }  else if (!line.compare(0, 2, "f ")) {
-            std::vector<Vec3i> f;
-            Vec3i tmp;
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
-                for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
-                f.push_back(tmp);
+    ObjChunk chunk;
+    std::int64_t total = 0, nlines = 0;
+    std::streamoff pos = 0;
+    while (std::getline(in, line)) {
+        std::streamoff start = pos;
+        pos += line.size() + 1;
+        if (line.compare(0, 2, "f ")) continue;
+        if (nlines++ % CHECKPOINT == 0) checkpoints.emplace_back(start, total);
+        int n = count_corners(line);
+        if (n < 0) {
+            parse_obj_line(line, chunk);
+            n = chunk.faces.back().size();
+            chunk.faces.clear();
+        }
+        total += ntriangles(n);
+    }
+    const std::int64_t begin = total*part/nparts, end = total*(part+1)/nparts;
+
+    // 第二遍：只保留范围内的三角面，记下它们引用的顶点属性下标
+    std::vector<int> used[3];
+    std::int64_t t = 0;
+    in.clear();
+    in.seekg(0);
+    for (const auto &[offset, before] : checkpoints) {
+        if (before > begin) break;
+        in.seekg(offset);
+        t = before;
+    }
+    while (t < end && std::getline(in, line)) {
+        if (line.compare(0, 2, "f ")) continue;
+        parse_obj_line(line, chunk);
+        std::vector<Vec3i> f = std::move(chunk.faces.back());
+        chunk.faces.clear();
+        int n = ntriangles(f.size());
+        if (t + n <= begin) {
+            t += n;
+            continue;
+        }
+        std::vector<std::vector<Vec3i> > tris(1, f);
+        triangulate(tris);
+        for (std::vector<Vec3i> &tri : tris) {
+            if (t >= begin && t < end) {
+                for (const Vec3i &c : tri)
+                    for (int k=0; k<3; k++) used[k].push_back(c[k]);
+                faces_.push_back(std::move(tri));
             }
-            faces_.push_back(f);
+            t++;
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
-    load_texture(filename, "_nm.tga",      normalmap_);
-    load_texture(filename, "_spec.tga",    specularmap_);
+    for (std::vector<int> &u : used) {
+        std::sort(u.begin(), u.end());
+        u.erase(std::unique(u.begin(), u.end()), u.end());
+        u.erase(u.begin(), std::lower_bound(u.begin(), u.end(), 0));
+    }
+
+    // 第三遍：只解析被引用的 v/vt/vn 行，都读到后提前结束；面的下标换成在读出的子集里的位置，
+    // 文件里不存在的下标与整体加载时一样原样保留
+    in.clear();
+    in.seekg(0);
+    chunk = ObjChunk();
+    std::int64_t idx[3] = {0, 0, 0};
+    size_t nread[3] = {0, 0, 0};
+    while ((nread[0] < used[0].size() || nread[1] < used[1].size() || nread[2] < used[2].size()) && std::getline(in, line)) {
+        if (line[0]!='v') continue;
+        int k = line[1]==' ' ? 0 : !line.compare(0, 3, "vt ") ? 1 : !line.compare(0, 3, "vn ") ? 2 : -1;
+        if (k < 0) continue;
+        if (nread[k] < used[k].size() && idx[k] == used[k][nread[k]]) {
+            parse_obj_line(line, chunk);
+            nread[k]++;
+        }
+        idx[k]++;
+    }
+    verts_.swap(chunk.verts);
+    uv_.swap(chunk.uvs);
+    norms_.swap(chunk.norms);
+    for (std::vector<Vec3i> &f : faces_) {
+        for (Vec3i &c : f) {
+            for (int k=0; k<3; k++) {
+                auto it = std::lower_bound(used[k].begin(), used[k].end(), c[k]);
+                if (it!=used[k].end() && *it==c[k] && size_t(it - used[k].begin()) < nread[k]) c[k] = it - used[k].begin();
+            }
+        }
+    }
+    // 顶点属性按首次使用的顺序排列，与整体加载后再 extract_faces 的结果逐项相同
+    extract_faces(verts_, uv_, norms_, faces_, 0, faces_.size());
+    std::cerr << "# part " << part << "/" << nparts << " of " << total << " faces, v# " << verts_.size() << " f# " << faces_.size()
+              << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
+}
+
+Model::~Model() {
+    for (int i=1; i<(int)lods_.size(); i++) delete lods_[i];
+}
+
+void Model::compute_bounds() {
+    if (verts_.empty()) return;
+    bbmin_ = bbmax_ = verts_[0];
+    for (const Vec3f &v : verts_) {
+        for (int i=0; i<3; i++) {
+            bbmin_[i] = std::min(bbmin_[i], v[i]);
+            bbmax_[i] = std::max(bbmax_[i], v[i]);
+        }
+    }
+
+    // 每 CLUSTER_SIZE 个连续的面组成一个簇
+    const int CLUSTER_SIZE = 64;
+    clusters_.clear();
+    for (int begin=0; begin<nfaces(); begin+=CLUSTER_SIZE) {
+        Cluster c = {begin, std::min(begin+CLUSTER_SIZE, nfaces()), vert(begin, 0), vert(begin, 0)};
+        for (int i=c.begin; i<c.end; i++) {
+            for (int j=0; j<3; j++) {
+                Vec3f v = vert(i, j);
+                for (int k=0; k<3; k++) {
+                    c.bbmin[k] = std::min(c.bbmin[k], v[k]);
+                    c.bbmax[k] = std::max(c.bbmax[k], v[k]);
+                }
+            }
+        }
+        clusters_.push_back(c);
+    }
+}
+
+namespace {
+
+const char TANGENT_MAGIC[4] = {'T','R','T','N'};
+
+}
+
+void Model::compute_tangents(const std::string &cachefile) {
+    PROFILE_SCOPE("tangents");
+    int nf = nfaces();
+
+    // 角点按 (uv, normal) 下标分组，同一组共享一个切线标架
+    std::unordered_map<std::int64_t, int> slots;
+    std::vector<int> first;                                 // 每组的第一个角点，用来取法线
+    tangent_index_.resize(nf*3);
+    for (int c=0; c<nf*3; c++) {
+        const Vec3i &corner = faces_[c/3][c%3];
+        std::int64_t key = (std::int64_t(corner[1]) << 32) | std::uint32_t(corner[2]);
+        auto [it, inserted] = slots.emplace(key, (int)first.size());
+        if (inserted) first.push_back(c);
+        tangent_index_[c] = it->second;
+    }
+    int nslots = first.size();
+
+    // 缓存按网格内容校验：顶点、uv、法线下标和坐标任何一个变了都会重算
+    const std::uint64_t hash = mesh_hash(verts_, uv_, norms_, faces_);
+
+    if (!cachefile.empty()) {
+        std::ifstream in(cachefile, std::ios::binary);
+        char magic[4];
+        std::uint64_t h = 0;
+        std::uint32_t n = 0;
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char *>(&h), sizeof(h));
+        in.read(reinterpret_cast<char *>(&n), sizeof(n));
+        if (in && !std::memcmp(magic, TANGENT_MAGIC, 4) && h==hash && int(n)==nslots) {
+            tangents_.resize(nslots);
+            bitangents_.resize(nslots);
+            in.read(reinterpret_cast<char *>(tangents_.data()), nslots*sizeof(Vec3f));
+            in.read(reinterpret_cast<char *>(bitangents_.data()), nslots*sizeof(Vec3f));
+            if (in) return;
+        }
+    }
+
+    // 逐面的切线和副切线：解 e1 = du1*T + dv1*B, e2 = du2*T + dv2*B，不归一化，相当于按 uv 面积加权
+    std::vector<Vec3f> ft(nf), fb(nf);
+    jobs::parallel_for(0, nf, 4096, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            Vec3f e1 = vert(i, 1) - vert(i, 0), e2 = vert(i, 2) - vert(i, 0);
+            Vec2f t0 = uv(i, 0), t1 = uv(i, 1), t2 = uv(i, 2);
+            float du1 = t1.x - t0.x, dv1 = t1.y - t0.y, du2 = t2.x - t0.x, dv2 = t2.y - t0.y;
+            float det = du1*dv2 - du2*dv1;
+            if (std::abs(det) < 1e-12f) {
+                ft[i] = fb[i] = Vec3f(0,0,0);
+                continue;
+            }
+            float inv = 1.f/det;
+            ft[i] = (e1*dv2 - e2*dv1)*inv;
+            fb[i] = (e2*du1 - e1*du2)*inv;
+        }
+    });
+
+    // 组 -> 角点的 CSR 表，按组并行累加，不需要原子操作
+    std::vector<int> offset(nslots+1, 0), corners(nf*3);
+    for (int c=0; c<nf*3; c++) offset[tangent_index_[c]+1]++;
+    for (int k=0; k<nslots; k++) offset[k+1] += offset[k];
+    std::vector<int> fill(offset.begin(), offset.end()-1);
+    for (int c=0; c<nf*3; c++) corners[fill[tangent_index_[c]]++] = c;
+
+    tangents_.resize(nslots);
+    bitangents_.resize(nslots);
+    jobs::parallel_for(0, nslots, 4096, [&](int begin, int end) {
+        for (int k=begin; k<end; k++) {
+            Vec3f t(0,0,0), b(0,0,0);
+            for (int j=offset[k]; j<offset[k+1]; j++) {
+                t = t + ft[corners[j]/3];
+                b = b + fb[corners[j]/3];
+            }
+            // Gram-Schmidt 正交化到法线上；副切线由 N x T 得到，符号保留 uv 镜像
+            Vec3f n = normal(first[k]/3, first[k]%3);
+            t = t - n*(n*t);
+            if (norm(t) < 1e-8f) t = cross(n, std::abs(n.x) < .9f ? Vec3f(1,0,0) : Vec3f(0,1,0));
+            t = normalized(t);
+            Vec3f nt = cross(n, t);
+            tangents_[k] = t;
+            bitangents_[k] = nt*b < 0 ? nt*-1.f : nt;
+        }
+    });
+
+    if (!cachefile.empty()) {
+        std::ofstream out(cachefile, std::ios::binary);
+        std::uint32_t n = nslots;
+        out.write(TANGENT_MAGIC, 4);
+        out.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+        out.write(reinterpret_cast<const char *>(&n), sizeof(n));
+        out.write(reinterpret_cast<const char *>(tangents_.data()), nslots*sizeof(Vec3f));
+        out.write(reinterpret_cast<const char *>(bitangents_.data()), nslots*sizeof(Vec3f));
+    }
+}
+
+Vec3f Model::center() {
+    return (bbmin_ + bbmax_)*.5f;
 }
 
-Model::~Model() {}
+float Model::radius() {
+    return norm(bbmax_ - bbmin_)*.5f;
+}
+
+Vec3f Model::bbmin() {
+    return bbmin_;
+}
+
+Vec3f Model::bbmax() {
+    return bbmax_;
+}
+
+int Model::nclusters() {
+    return (int)clusters_.size();
+}
+
+const Cluster &Model::cluster(int i) {
+    return clusters_[i];
+}
+
+void Model::save_obj(const char *filename) {
+    std::vector<Vec3f> verts, norms;
+    std::vector<Vec2f> uvs;
+    std::vector<std::vector<Vec3i> > faces;
+    if (compact_) packed_.unpack(verts, uvs, norms, faces);
+    const std::vector<Vec3f> &vs = compact_ ? verts : verts_, &ns = compact_ ? norms : norms_;
+    const std::vector<Vec2f> &ts = compact_ ? uvs : uv_;
+    std::ofstream out(filename);
+    for (const Vec3f &v : vs)  out << "v "  << v.x << " " << v.y << " " << v.z << "\n";
+    for (const Vec2f &t : ts)  out << "vt  " << t.x << " " << t.y << " 0\n";
+    for (const Vec3f &n : ns)  out << "vn  " << n.x << " " << n.y << " " << n.z << "\n";
+    for (const std::vector<Vec3i> &f : compact_ ? faces : faces_) {
+        out << "f";
+        for (const Vec3i &c : f) out << " " << c[0]+1 << "/" << c[1]+1 << "/" << c[2]+1;
+        out << "\n";
+    }
+}
+
+void Model::build_lods(int nlevels, float ratio, const std::string &cache_dir) {
+    PROFILE_SCOPE("lod_build");
+    for (int i=1; i<(int)lods_.size(); i++) delete lods_[i];
+    lods_.assign(1, this);
+    if (!nfaces()) return;
+
+    // 每级只取决于基础网格、级号和 ratio：基础网格按实际用来简化的数据（压缩时为量化后的顶点，优化时为重排后的面）散列，
+    // 与 ratio 一起写进文件名，换加载选项或 ratio 时不会读到别的网格的缓存
+    std::string stem;
+    const bool cache = !cache_dir.empty() && !partial_;
+    if (cache) {
+        std::uint64_t hash;
+        if (compact_) {
+            std::vector<Vec3f> verts, norms;
+            std::vector<Vec2f> uvs;
+            std::vector<std::vector<Vec3i> > faces;
+            packed_.unpack(verts, uvs, norms, faces);
+            hash = mesh_hash(verts, uvs, norms, faces);
+        } else {
+            hash = mesh_hash(verts_, uv_, norms_, faces_);
+        }
+        char key[32];
+        snprintf(key, sizeof(key), "_%016llx", (unsigned long long)hash);
+        std::error_code ec;
+        std::filesystem::create_directories(cache_dir, ec);
+        stem = (std::filesystem::path(cache_dir) / std::filesystem::path(filename_).stem()).string() + key;
+    }
+    for (int level=1; level<nlevels; level++) {
+        Model *prev = lods_.back();
+        Model *m = new Model();
+        m->base_ = this;
+        std::string cachefile = cache ? stem + "_lod" + std::to_string(level) + "_r" + std::to_string(int(std::lround(ratio*1000))) + ".obj" : filename_;
+        std::error_code ec;
+        bool fresh = cache && std::filesystem::exists(cachefile, ec);
+        if (fresh) {
+            m->load_obj(cachefile.c_str());
+        } else {
+            if (prev->compact_) {
+                prev->packed_.unpack(m->verts_, m->uv_, m->norms_, m->faces_);
+            } else {
+                m->verts_ = prev->verts_;
+                m->faces_ = prev->faces_;
+                m->uv_    = prev->uv_;
+                m->norms_ = prev->norms_;
+            }
+            simplify_mesh(m->verts_, m->faces_, prev->nfaces()*ratio);
+            if (cache) m->save_obj(cachefile.c_str());
+        }
+        m->filename_ = cachefile;
+        m->compute_bounds();
+        if (has_tangents()) m->compute_tangents("");
+        if (compact_) m->compact();
+        std::cerr << "lod " << level << " f# " << m->nfaces() << (fresh ? " (cached)" : "") << std::endl;
+        lods_.push_back(m);
+    }
+}
+
+int Model::nlods() {
+    return std::max(1, (int)lods_.size());
+}
+
+Model *Model::lod(int level) {
+    if (lods_.empty()) return this;
+    return lods_[std::min(std::max(level, 0), (int)lods_.size()-1)];
+}
+
+Model *Model::lod_for(float radius_px, float px_per_face) {
+    float budget = 3.14159265f*radius_px*radius_px/px_per_face;
+    for (int i=0; i<nlods(); i++) {
+        if (lod(i)->nfaces() <= budget) return lod(i);
+    }
+    return lod(nlods()-1);
+}
 
 int Model::nverts() {
-    return (int)verts_.size();
+    return compact_ ? packed_.nverts() : (int)verts_.size();
 }
 
 int Model::nfaces() {
-    return (int)faces_.size();
+    return compact_ ? packed_.nfaces() : (int)faces_.size();
 }
 
 std::vector<int> Model::face(int idx) {
     std::vector<int> face;
+    if (compact_) {
+        for (int i=0; i<3; i++) face.push_back(packed_.index(idx*3 + i, 0));
+        return face;
+    }
     for (int i=0; i<(int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
     return face;
 }
 
 Vec3f Model::vert(int i) {
-    return verts_[i];
+    return compact_ ? packed_.vert(i) : verts_[i];
 }
 
 Vec3f Model::vert(int iface, int nthvert) {
+    if (compact_) return packed_.vert(packed_.index(iface*3 + nthvert, 0));
     return verts_[faces_[iface][nthvert][0]];
 }
 
-void Model::load_texture(std::string filename, const char *suffix, TGAImage &img) {
+void Model::load_texture(std::string filename, const char *suffix, const ModelOptions &options, BlockFormat format, LazyTexture &tex, LazyCompressedTexture &blocks) {
     std::string texfile(filename);
     size_t dot = texfile.find_last_of(".");
-    if (dot!=std::string::npos) {
-        texfile = texfile.substr(0,dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
+    if (dot==std::string::npos) return;
+    texfile = texfile.substr(0,dot) + std::string(suffix);
+    // Lazy 在第一次采样的线程上解码，其余交给线程池
+    bool deferred = options.textures==TextureLoad::Lazy;
+    if (options.compress_textures) {
+        auto load = [texfile, format]() {
+            CompressedTexture t = TextureCache::instance().load_compressed(texfile, format);
+            std::cerr << "texture file " << texfile << " loading " << (t ? "ok (compressed)" : "failed") << std::endl;
+            return t;
+        };
+        blocks.reset(deferred ? std::async(std::launch::deferred, load).share() : jobs::async(load));
+        if (options.textures==TextureLoad::Eager) blocks.get();
+        return;
     }
+    auto load = [texfile]() {
+        Texture t = TextureCache::instance().load(texfile);
+        std::cerr << "texture file " << texfile << " loading " << (t ? "ok" : "failed") << std::endl;
+        return t;
+    };
+    tex.reset(deferred ? std::async(std::launch::deferred, load).share() : jobs::async(load));
+    if (options.textures==TextureLoad::Eager) tex.get();
 }
 
-TGAColor Model::diffuse(Vec2f uvf) {
-    Vec2i uv(uvf[0]*diffusemap_.width(), uvf[1]*diffusemap_.height());
-    return diffusemap_.get(uv[0], uv[1]);
+namespace {
+
+// 最近点采样，TGAImage 和 BlockTexture 共用
+template<typename T> TGAColor sample(const T *tex, Vec2f uvf) {
+    Vec2i uv(uvf[0]*tex->width(), uvf[1]*tex->height());
+    return tex->get(uv[0], uv[1]);
 }
 
-Vec3f Model::normal(Vec2f uvf) {
-    Vec2i uv(uvf[0]*normalmap_.width(), uvf[1]*normalmap_.height());
-    TGAColor c = normalmap_.get(uv[0], uv[1]);
+// 法线贴图的 RGB -> [-1, 1] 的 xyz
+Vec3f decode_normal(TGAColor c) {
     Vec3f res;
     for (int i=0; i<3; i++)
         res[2-i] = (float)c[i]/255.f*2.f - 1.f;
     return res;
 }
 
+}
+
+TGAColor Model::diffuse(Vec2f uvf) {
+    if (base_) return base_->diffuse(uvf);
+    if (compressed_) {
+        const BlockTexture *blocks = diffuseblocks_.get();
+        return blocks ? sample(blocks, uvf) : TGAColor();
+    }
+    const TGAImage *diffusemap = diffusemap_.get();
+    if (!diffusemap) return {};
+    return sample(diffusemap, uvf);
+}
+
+void Model::diffuse(const float *u, const float *v, unsigned mask, std::uint32_t *texels) {
+    if (base_) return base_->diffuse(u, v, mask, texels);
+    if (compressed_) {
+        const BlockTexture *blocks = diffuseblocks_.get();
+        if (blocks) return sample8(*blocks, u, v, mask, texels);
+    } else {
+        const TGAImage *diffusemap = diffusemap_.get();
+        if (diffusemap) return sample8(*diffusemap, u, v, mask, texels);
+    }
+    std::fill(texels, texels + 8, 0);
+}
+
+Vec3f Model::normal(Vec2f uvf) {
+    if (base_) return base_->normal(uvf);
+    TGAColor c;
+    if (compressed_) {
+        const BlockTexture *blocks = normalblocks_.get();
+        if (!blocks) return {};
+        c = sample(blocks, uvf);
+    } else {
+        const TGAImage *normalmap = normalmap_.get();
+        if (!normalmap) return {};
+        c = sample(normalmap, uvf);
+    }
+    return decode_normal(c);
+}
+
+Vec3f Model::tangent_normal(Vec2f uvf) {
+    if (base_) return base_->tangent_normal(uvf);
+    TGAColor c;
+    if (compressed_) {
+        const BlockTexture *blocks = tangentblocks_.get();
+        if (!blocks) return {};
+        c = sample(blocks, uvf);
+    } else {
+        const TGAImage *tangentmap = tangentmap_.get();
+        if (!tangentmap) return {};
+        c = sample(tangentmap, uvf);
+    }
+    return decode_normal(c);
+}
+
+void Model::tangent_normal(const float *u, const float *v, unsigned mask, float (*n)[8]) {
+    if (base_) return base_->tangent_normal(u, v, mask, n);
+    std::uint32_t texels[8];
+    const BlockTexture *blocks = compressed_ ? tangentblocks_.get() : NULL;
+    const TGAImage *tangentmap = compressed_ ? NULL : tangentmap_.get();
+    if (blocks) sample8(*blocks, u, v, mask, texels);
+    else if (tangentmap) sample8(*tangentmap, u, v, mask, texels);
+    else {
+        for (int k=0; k<3; k++) std::fill(n[k], n[k] + 8, 0.f);
+        return;
+    }
+    // 与 decode_normal 相同：字节 0, 1, 2 为 b, g, r，对应 z, y, x
+    for (int k=0; k<3; k++)
+        for (int i=0; i<8; i++) n[2-k][i] = (float)(texels[i] >> 8*k & 255)/255.f*2.f - 1.f;
+}
+
+bool Model::has_tangents() {
+    return !tangents_.empty();
+}
+
+Vec3f Model::tangent(int iface, int nthvert) {
+    if (tangents_.empty()) return {};
+    return tangents_[tangent_index_[iface*3 + nthvert]];
+}
+
+Vec3f Model::bitangent(int iface, int nthvert) {
+    if (bitangents_.empty()) return {};
+    return bitangents_[tangent_index_[iface*3 + nthvert]];
+}
+
 Vec2f Model::uv(int iface, int nthvert) {
+    if (compact_) return packed_.uv(packed_.index(iface*3 + nthvert, 1));
     return uv_[faces_[iface][nthvert][1]];
 }
 
 float Model::specular(Vec2f uvf) {
-    Vec2i uv(uvf[0]*specularmap_.width(), uvf[1]*specularmap_.height());
-    return specularmap_.get(uv[0], uv[1])[0]/1.f;
+    if (base_) return base_->specular(uvf);
+    if (compressed_) {
+        const BlockTexture *blocks = specularblocks_.get();
+        return blocks ? sample(blocks, uvf)[0]/1.f : 0;
+    }
+    const TGAImage *specularmap = specularmap_.get();
+    if (!specularmap) return 0;
+    return sample(specularmap, uvf)[0]/1.f;
+}
+
+float Model::ambient_occlusion(Vec2f uvf) {
+    if (base_) return base_->ambient_occlusion(uvf);
+    if (compressed_) {
+        const BlockTexture *blocks = ambientblocks_.get();
+        return blocks ? sample(blocks, uvf)[0]/255.f : 1.f;
+    }
+    const TGAImage *ambientmap = ambientmap_.get();
+    if (!ambientmap) return 1.f;
+    return sample(ambientmap, uvf)[0]/255.f;
+}
+
+void Model::ambient_occlusion(const float *u, const float *v, unsigned mask, float *ao) {
+    if (base_) return base_->ambient_occlusion(u, v, mask, ao);
+    std::uint32_t texels[8];
+    const BlockTexture *blocks = compressed_ ? ambientblocks_.get() : NULL;
+    const TGAImage *ambientmap = compressed_ ? NULL : ambientmap_.get();
+    if (blocks) sample8(*blocks, u, v, mask, texels);
+    else if (ambientmap) sample8(*ambientmap, u, v, mask, texels);
+    else {
+        std::fill(ao, ao + 8, 1.f);
+        return;
+    }
+    for (int i=0; i<8; i++) ao[i] = (texels[i] & 255)/255.f;
 }
 
 Vec3f Model::normal(int iface, int nthvert) {
+    if (compact_) return packed_.normal(packed_.index(iface*3 + nthvert, 2));
     int idx = faces_[iface][nthvert][2];
     return normalized(norms_[idx]);
 }
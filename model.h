@@ -4,6 +4,27 @@
 #include <string>
 #include "geometrylix.h"
 #include "tgaimage.h"
+#include "texcache.h"
+#include "meshopt.h"
+
+// 纹理加载方式：Eager 在构造时同步加载；Lazy 在第一次采样时加载；Async 在构造开始时交给线程池（见 jobs.h），与 OBJ 解析重叠
+enum class TextureLoad { Eager, Lazy, Async };
+
+// 一段连续的面及其包围盒，用于簇级别的剔除
+struct Cluster {
+    int begin, end;
+    Vec3f bbmin, bbmax;
+};
+
+struct ModelOptions {
+    TextureLoad textures = TextureLoad::Async;
+    bool optimize_mesh   = true;    // 加载后按顶点缓存重排三角形，并把顶点数据重排为首次使用顺序
+    bool compress_textures = false; // 贴图以 4x4 块压缩格式驻留内存，采样时逐纹素解码；压缩结果缓存为 <贴图>.bc1/.bc4/.bc5
+    bool tangents = false;          // 加载时计算逐顶点切线标架（并行），结果缓存为 <name>_tangents.bin
+    bool compact_vertices = false;  // 顶点属性和面表以量化格式驻留内存，访问时解码，见 CompactMesh；LOD 同样压缩
+    int  part = 0, nparts = 1;      // nparts > 1 时只读入按文件中的面序等分的第 part 份面及其引用的顶点，见 sortlast.h；
+                                    // 切线和 LOD 的磁盘缓存按整个模型命名，分片时不读写
+};
 
 class Model {
 private:
@@ -11,22 +32,78 @@ private:
     std::vector<std::vector<Vec3i> > faces_; // attention, this Vec3i means vertex/uv/normal
     std::vector<Vec3f> norms_;
     std::vector<Vec2f> uv_;
-    TGAImage diffusemap_;
-    TGAImage normalmap_;
-    TGAImage specularmap_;
-    void load_texture(std::string filename, const char *suffix, TGAImage &img);
+    LazyTexture diffusemap_;        // 纹理由 TextureCache 共享，多个 Model 引用同一张贴图时只有一份
+    LazyTexture normalmap_;
+    LazyTexture specularmap_;
+    LazyTexture tangentmap_;        // 切线空间法线贴图 _nm_tangent.tga
+    LazyTexture ambientmap_;        // 烘焙的环境光遮蔽 _ao.tga，见 bake.cpp
+    LazyCompressedTexture diffuseblocks_;   // compressed_ 为 true 时代替上面五张贴图
+    LazyCompressedTexture normalblocks_;
+    LazyCompressedTexture specularblocks_;
+    LazyCompressedTexture tangentblocks_;
+    LazyCompressedTexture ambientblocks_;
+    bool compressed_;
+    std::string filename_;
+    Vec3f bbmin_, bbmax_;
+    Model *base_;                   // LOD 层级指向基础模型，纹理查询转发给它
+    std::vector<Model*> lods_;      // lods_[0] 为基础模型自身
+    std::vector<Cluster> clusters_;
+    std::vector<int> tangent_index_;        // 每个角点 (iface*3 + nthvert) 对应的切线标架下标
+    std::vector<Vec3f> tangents_;           // 按 (uv, normal) 下标组合去重，uv 接缝和硬边两侧各有一份
+    std::vector<Vec3f> bitangents_;
+    bool compact_;                  // 为 true 时 verts_/faces_/norms_/uv_ 为空，数据在 packed_ 中
+    CompactMesh packed_;
+    bool partial_;                  // 只加载了模型的一部分面
+    Model();
+    void load_obj(const char *filename);
+    // 只解析按文件中的面序等分的第 part 份三角面和它们引用的顶点属性，不把整个文件读入内存
+    void load_obj_part(const char *filename, int part, int nparts);
+    void load_texture(std::string filename, const char *suffix, const ModelOptions &options, BlockFormat format, LazyTexture &tex, LazyCompressedTexture &blocks);
+    void compute_bounds();
+    void compute_tangents(const std::string &cachefile);
+    void compact();
 public:
-    Model(const char *filename);
+    Model(const char *filename, const ModelOptions &options = ModelOptions());
     ~Model();
+    // LOD 层级由 lods_ 持有，不能复制
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
+    void save_obj(const char *filename);
+    // 生成 nlevels 级 LOD，每级面数为上一级的 ratio 倍；cache_dir 非空时结果缓存在其中，
+    // 文件名为 <name>_<基础网格的散列>_lod<k>_r<ratio 的千分数>.obj；没有面（加载失败）的模型不生成
+    void build_lods(int nlevels, float ratio=.5f, const std::string &cache_dir="");
+    int nlods();
+    Model *lod(int level);
+    // 按包围球的屏幕半径（像素）选 LOD：取每个面平均至少覆盖 px_per_face 像素的最精细一级
+    Model *lod_for(float radius_px, float px_per_face=4.f);
+    Vec3f center();
+    float radius();
+    Vec3f bbmin();
+    Vec3f bbmax();
+    int nclusters();
+    const Cluster &cluster(int i);
     int nverts();
     int nfaces();
     Vec3f normal(int iface, int nthvert);
     Vec3f normal(Vec2f uv);
+    // 单位切线和副切线，与 normal(iface, nthvert) 构成 TBN 基；没有计算切线时返回零向量
+    bool has_tangents();
+    Vec3f tangent(int iface, int nthvert);
+    Vec3f bitangent(int iface, int nthvert);
+    // 切线空间法线贴图的采样，分量在 [-1, 1]；没有该贴图时返回零向量
+    Vec3f tangent_normal(Vec2f uv);
     Vec3f vert(int i);
     Vec3f vert(int iface, int nthvert);
     Vec2f uv(int iface, int nthvert);
     TGAColor diffuse(Vec2f uv);
+    // 8 路批量采样，供 IShader::fragment_batch 使用；mask 为 0 的路和没有贴图时输出 0，纹素打包方式见 sampler.h
+    void diffuse(const float *u, const float *v, unsigned mask, std::uint32_t *texels);
+    // 切线空间法线分别写入 n[0], n[1], n[2] 的 8 路
+    void tangent_normal(const float *u, const float *v, unsigned mask, float (*n)[8]);
     float specular(Vec2f uv);
+    // 环境光遮蔽，1 为完全不被遮挡；没有 _ao.tga 时返回 1
+    float ambient_occlusion(Vec2f uv);
+    void ambient_occlusion(const float *u, const float *v, unsigned mask, float *ao);
     std::vector<int> face(int idx);
 };
 #endif //__MODEL_H__
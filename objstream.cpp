@@ -0,0 +1,219 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "objstream.h"
+#include "gl.h"
+
+namespace {
+
+// OBJ 下标从 1 开始，负数为相对于目前已读到的 count 个元素从后往前数；0 和越界的负数换成 -1
+int resolve_index(long idx, size_t count) {
+    if (idx > 0) return idx - 1 <= INT_MAX ? int(idx - 1) : -1;
+    if (idx < 0 && size_t(-idx) <= count) return int(count + idx);
+    return -1;
+}
+
+// 读取 "v/vt/vn"、"v//vn"、"v/vt" 或 "v" 形式的一个角点，counts 为此前已读到的 v/vt/vn 个数
+bool parse_corner(const char *&p, Vec3i &c, const size_t counts[3]) {
+    char *end;
+    while (*p==' ' || *p=='\t') p++;
+    c = {-1, -1, -1};
+    long v = std::strtol(p, &end, 10);
+    if (end==p) return false;
+    c[0] = resolve_index(v, counts[0]);
+    p = end;
+    for (int i=1; i<3 && *p=='/'; i++) {
+        p++;
+        long idx = std::strtol(p, &end, 10);
+        if (end!=p) c[i] = resolve_index(idx, counts[i]);
+        p = end;
+    }
+    return true;
+}
+
+}
+
+ObjStream::ObjStream(const char *filename, size_t memory_budget, const std::string &spill_dir) : filename_(filename), budget_(memory_budget) {
+    std::ifstream in(filename);
+    if (in.fail()) return;
+
+    std::filesystem::path dir = spill_dir.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(spill_dir);
+    std::string stem = (dir / std::filesystem::path(filename).filename()).string() + "." + std::to_string(getpid());
+    verts_.path = stem + ".v";
+    uvs_.path   = stem + ".vt";
+    norms_.path = stem + ".vn";
+    std::ofstream vout(verts_.path, std::ios::binary), tout(uvs_.path, std::ios::binary), nout(norms_.path, std::ios::binary);
+    if (!vout || !tout || !nout) {
+        std::cerr << "can't create spill files in " << dir << "\n";
+        return;
+    }
+
+    // 第一遍：只取顶点属性
+    std::string line;
+    while (std::getline(in, line)) {
+        const char *p = line.c_str();
+        char *end;
+        if (p[0]=='v' && p[1]==' ') {
+            float v[3];
+            p += 2;
+            for (int i=0; i<3; i++, p=end) v[i] = std::strtof(p, &end);
+            vout.write(reinterpret_cast<const char *>(v), sizeof(v));
+        } else if (p[0]=='v' && p[1]=='t' && p[2]==' ') {
+            float t[2];
+            p += 3;
+            for (int i=0; i<2; i++, p=end) t[i] = std::strtof(p, &end);
+            tout.write(reinterpret_cast<const char *>(t), sizeof(t));
+        } else if (p[0]=='v' && p[1]=='n' && p[2]==' ') {
+            float n[3];
+            p += 3;
+            for (int i=0; i<3; i++, p=end) n[i] = std::strtof(p, &end);
+            nout.write(reinterpret_cast<const char *>(n), sizeof(n));
+        }
+    }
+    vout.close();
+    tout.close();
+    nout.close();
+
+    map(verts_);
+    map(uvs_);
+    map(norms_);
+    ok_ = verts_.bytes>0;
+    std::cerr << "# stream v# " << nverts() << " vt# " << nuvs() << " vn# " << nnorms() << std::endl;
+}
+
+ObjStream::~ObjStream() {
+    for (Spill *s : {&verts_, &uvs_, &norms_}) {
+        unmap(*s);
+        if (!s->path.empty()) std::remove(s->path.c_str());
+    }
+}
+
+void ObjStream::map(Spill &s) {
+    s.fd = open(s.path.c_str(), O_RDONLY);
+    if (s.fd < 0) return;
+    s.bytes = lseek(s.fd, 0, SEEK_END);
+    if (!s.bytes) return;
+    s.data = mmap(NULL, s.bytes, PROT_READ, MAP_SHARED, s.fd, 0);
+    if (s.data==MAP_FAILED) {
+        s.data = NULL;
+        s.bytes = 0;
+    }
+}
+
+void ObjStream::unmap(Spill &s) {
+    if (s.data) munmap(s.data, s.bytes);
+    if (s.fd >= 0) close(s.fd);
+    s.data = NULL;
+    s.fd = -1;
+}
+
+// 映射的总量超过预算时，丢掉已经读入的页；之后再访问会从溢出文件重新读
+void ObjStream::trim() {
+    if (verts_.bytes + uvs_.bytes + norms_.bytes <= budget_) return;
+    for (Spill *s : {&verts_, &uvs_, &norms_})
+        if (s->data) madvise(s->data, s->bytes, MADV_DONTNEED);
+}
+
+bool ObjStream::ok() {
+    return ok_;
+}
+
+size_t ObjStream::nverts() {
+    return verts_.bytes/sizeof(Vec3f);
+}
+
+size_t ObjStream::nuvs() {
+    return uvs_.bytes/sizeof(Vec2f);
+}
+
+size_t ObjStream::nnorms() {
+    return norms_.bytes/sizeof(Vec3f);
+}
+
+Vec3f ObjStream::vert(int i) {
+    if (i<0 || size_t(i)>=nverts()) return {};
+    const float *p = static_cast<const float *>(verts_.data) + size_t(i)*3;
+    return {p[0], p[1], p[2]};
+}
+
+Vec2f ObjStream::uv(int i) {
+    if (i<0 || size_t(i)>=nuvs()) return {};
+    const float *p = static_cast<const float *>(uvs_.data) + size_t(i)*2;
+    return {p[0], p[1]};
+}
+
+Vec3f ObjStream::normal(int i) {
+    if (i<0 || size_t(i)>=nnorms()) return {};
+    const float *p = static_cast<const float *>(norms_.data) + size_t(i)*3;
+    return normalized(Vec3f(p[0], p[1], p[2]));
+}
+
+void ObjStream::for_each_chunk(const std::function<void(const std::vector<Vec3i> &corners)> &fn) {
+    if (!ok_) return;
+    std::ifstream in(filename_);
+    // 面缓冲最多占一半预算，另一半留给映射的顶点属性页
+    size_t chunk = std::max<size_t>(3, budget_/2/sizeof(Vec3i)/3*3);
+    std::vector<Vec3i> corners;
+    corners.reserve(chunk);
+    std::vector<Vec3i> poly;
+    size_t counts[3] = {0, 0, 0};                           // 到当前行为止的 v/vt/vn 个数，用来解析负下标
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line[0]=='v') {
+            if (line[1]==' ') counts[0]++;
+            else if (line[1]=='t' && line[2]==' ') counts[1]++;
+            else if (line[1]=='n' && line[2]==' ') counts[2]++;
+            continue;
+        }
+        if (line.compare(0, 2, "f ")) continue;
+        const char *p = line.c_str() + 2;
+        Vec3i c;
+        poly.clear();
+        while (parse_corner(p, c, counts)) {
+            // 引用不存在的顶点的面无法渲染，整个丢掉
+            if (c[0] < 0 || size_t(c[0]) >= nverts()) {
+                poly.clear();
+                break;
+            }
+            poly.push_back(c);
+        }
+        for (int i=2; i<(int)poly.size(); i++) {
+            corners.push_back(poly[0]);
+            corners.push_back(poly[i-1]);
+            corners.push_back(poly[i]);
+        }
+        if (corners.size() + 3 > chunk) {
+            fn(corners);
+            corners.clear();
+            trim();
+        }
+    }
+    if (!corners.empty()) fn(corners);
+}
+
+void stream_render(const char *filename, size_t memory_budget, IShader &shader, TGAImage &image, float *zbuffer) {
+    ObjStream obj(filename, memory_budget);
+    shader.prepare();
+    obj.for_each_chunk([&](const std::vector<Vec3i> &corners) {
+        for (size_t i=0; i+2<corners.size(); i+=3) {
+            Vec3f v[3];
+            for (int j=0; j<3; j++) v[j] = obj.vert(corners[i+j][0]);
+            Vec3f n = normalized(cross(v[1]-v[0], v[2]-v[0]));    // 没有法线时用面法线
+
+            Vec4f clip_coords[3];
+            Vec2f uvs[3];
+            for (int j=0; j<3; j++) {
+                const Vec3i &c = corners[i+j];
+                clip_coords[j] = shader.vertex(v[j], c[2]>=0 ? obj.normal(c[2]) : n, j);
+                uvs[j] = obj.uv(c[1]);
+            }
+            triangle(clip_coords, uvs, shader, image, zbuffer);
+        }
+    });
+}
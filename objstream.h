@@ -0,0 +1,56 @@
+#ifndef __OBJSTREAM_H__
+#define __OBJSTREAM_H__
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include "geometrylix.h"
+
+struct IShader;
+struct TGAImage;
+
+// 超出内存的 OBJ 的流式读取：第一遍把 v/vt/vn 写进溢出文件并做内存映射，第二遍按块读取面，
+// 面缓冲和映射页的常驻量都受 memory_budget 限制（映射页是可回收的文件页，每块结束后超额部分会被释放）
+class ObjStream {
+public:
+    ObjStream(const char *filename, size_t memory_budget, const std::string &spill_dir = "");
+    ~ObjStream();
+    ObjStream(const ObjStream &) = delete;
+    ObjStream& operator=(const ObjStream &) = delete;
+
+    bool ok();
+    size_t nverts();
+    size_t nuvs();
+    size_t nnorms();
+    // 越界的下标返回零向量
+    Vec3f vert(int i);
+    Vec2f uv(int i);
+    Vec3f normal(int i);
+
+    // 按块读取三角面（n 边形按扇形拆分），每块调用一次 fn；corners 每 3 个为一个三角面，
+    // 下标为 vertex/uv/normal，已换成从 0 开始的绝对下标（负下标按所在行之前的元素个数解析）；
+    // 缺失或越界的 uv/normal 下标为 -1，引用不存在顶点的面被丢掉
+    void for_each_chunk(const std::function<void(const std::vector<Vec3i> &corners)> &fn);
+
+private:
+    struct Spill {
+        std::string path;
+        int fd = -1;
+        void *data = NULL;
+        size_t bytes = 0;
+    };
+
+    std::string filename_;
+    size_t budget_;
+    bool ok_ = false;
+    Spill verts_, uvs_, norms_;
+
+    void map(Spill &s);
+    void unmap(Spill &s);
+    void trim();
+};
+
+// 流式渲染：不建立 Model，面块读出后直接经过顶点着色器送入光栅化；缺失的法线用面法线代替
+void stream_render(const char *filename, size_t memory_budget, IShader &shader, TGAImage &image, float *zbuffer);
+
+#endif //__OBJSTREAM_H__
@@ -0,0 +1,106 @@
+#ifndef __OCCLUSION_H__
+#define __OCCLUSION_H__
+#include <vector>
+#include "render.h"
+
+// 软件遮挡剔除：把选定的遮挡体（或上一帧的深度）保守地光栅化到一个低分辨率深度缓冲里，
+// 再用物体和簇的包围盒在提交前做遮挡测试。深度约定与 zbuffer 相同：值越大越靠近相机
+// camera 为绘制所用的 Viewport*Projection*ModelView
+struct OcclusionBuffer {
+    int w, h;
+    int screen_w, screen_h;
+    mat<4,4,float> camera;
+    std::vector<float> depth;
+
+    OcclusionBuffer(int w, int h, int screen_w, int screen_h, const mat<4,4,float> &camera)
+        : w(w), h(h), screen_w(screen_w), screen_h(screen_h), camera(camera), depth(w*h) {
+        clear();
+    }
+
+    void clear() {
+        std::fill(depth.begin(), depth.end(), -std::numeric_limits<float>::max());
+    }
+
+    // 模型坐标 -> 遮挡缓冲坐标
+    mat<4,4,float> transform(const mat<4,4,float> &M) const {
+        mat<4,4,float> S = {{{float(w)/screen_w, 0, 0, 0}, {0, float(h)/screen_h, 0, 0}, {0,0,1,0}, {0,0,0,1}}};
+        return S*camera*M;
+    }
+
+    // 保守地光栅化一个遮挡体：深度取每个像素内最远的值
+    void add_occluder(Model &model, const mat<4,4,float> &M = identity<4>()) {
+        mat<4,4,float> T = transform(M);
+        for (int i=0; i<model.nfaces(); i++) {
+            Vec4f clip[3];
+            bool behind = false;
+            for (int j=0; j<3; j++) {
+                Vec3f v = model.vert(i, j);
+                clip[j] = T*Vec4f(v.x, v.y, v.z, 1);
+                behind |= clip[j].w <= 0;
+            }
+            if (!behind) triangle_depth(clip, depth.data(), w, h, true);
+        }
+    }
+
+    // 用上一帧的全分辨率深度做遮挡体（相机不动或变化很小时）：每个低分辨率像素取所覆盖区域里最远的深度
+    void from_zbuffer(const float *zbuffer) {
+        for (int y=0; y<h; y++) {
+            int y0 = y*screen_h/h, y1 = std::max(y0+1, (y+1)*screen_h/h);
+            for (int x=0; x<w; x++) {
+                int x0 = x*screen_w/w, x1 = std::max(x0+1, (x+1)*screen_w/w);
+                float z = std::numeric_limits<float>::max();
+                for (int j=y0; j<y1; j++)
+                    for (int i=x0; i<x1; i++)
+                        z = std::min(z, zbuffer[i + j*screen_w]);
+                depth[x + y*w] = z;
+            }
+        }
+    }
+
+    // 模型坐标包围盒经 M 变换后是否被完全遮挡；跨过相机平面的包围盒一律视为可见
+    bool occluded(Vec3f bbmin, Vec3f bbmax, const mat<4,4,float> &M = identity<4>()) const {
+        mat<4,4,float> T = transform(M);
+        float xmin = std::numeric_limits<float>::max(), ymin = xmin, xmax = -xmin, ymax = -xmin;
+        float znear = -std::numeric_limits<float>::max();
+        for (int i=0; i<8; i++) {
+            Vec4f c = T*Vec4f(i&1 ? bbmax.x : bbmin.x, i&2 ? bbmax.y : bbmin.y, i&4 ? bbmax.z : bbmin.z, 1);
+            if (c.w <= 0) return false;
+            xmin = std::min(xmin, c.x/c.w);
+            xmax = std::max(xmax, c.x/c.w);
+            ymin = std::min(ymin, c.y/c.w);
+            ymax = std::max(ymax, c.y/c.w);
+            znear = std::max(znear, c.z/c.w);
+        }
+        // 包围盒覆盖到的所有像素再外扩一个像素，抵消遮挡体按像素中心判断覆盖带来的误差；屏幕外的部分本来就不可见
+        int x0 = std::max(0, (int)std::floor(xmin) - 1), x1 = std::min(w-1, (int)std::ceil(xmax) + 1);
+        int y0 = std::max(0, (int)std::floor(ymin) - 1), y1 = std::min(h-1, (int)std::ceil(ymax) + 1);
+        for (int y=y0; y<=y1; y++)
+            for (int x=x0; x<=x1; x++)
+                if (depth[x + y*w] < znear) return false;
+        return true;
+    }
+};
+
+// 带遮挡剔除的绘制：先测整个物体的包围盒，再逐簇测试，只把可能可见的簇送进顶点阶段和光栅化
+// 物体的模型矩阵取自 shader.uniform_M；返回实际提交的面数
+inline int draw_model_occluded(Model &model, IShader &shader, TGAImage &image, float *zbuffer, const OcclusionBuffer &occ) {
+    const bool timed = PROFILE_ENABLED();
+    if (occ.occluded(model.bbmin(), model.bbmax(), shader.uniform_M)) {
+        if (timed) profiler::count("occluded_objects", 1);
+        return 0;
+    }
+    int submitted = 0, culled = 0;
+    for (int c=0; c<model.nclusters(); c++) {
+        const Cluster &cl = model.cluster(c);
+        if (occ.occluded(cl.bbmin, cl.bbmax, shader.uniform_M)) {
+            culled++;
+            continue;
+        }
+        draw_faces(model, cl.begin, cl.end, shader, image, zbuffer);
+        submitted += cl.end - cl.begin;
+    }
+    if (timed) profiler::count("occluded_clusters", culled);
+    return submitted;
+}
+
+#endif //__OCCLUSION_H__
@@ -0,0 +1,138 @@
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#include "profiler.h"
+
+namespace profiler {
+
+std::atomic<bool> enabled_ = false;
+
+namespace {
+
+struct Event {
+    const char *name;
+    std::int64_t begin, end;
+};
+
+struct ThreadData {
+    int tid;
+    std::vector<Event> events;
+    std::vector<Stat> stats;
+    std::vector<const char *> keys;         // 与 stats 一一对应，先按指针比较
+};
+
+std::mutex mutex;
+std::vector<std::unique_ptr<ThreadData> > threads;     // 线程退出后数据仍保留，直到 reset
+std::int64_t origin = now();
+thread_local ThreadData *local = NULL;
+
+ThreadData &data() {
+    if (!local) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::make_unique<ThreadData>());
+        local = threads.back().get();
+        local->tid = threads.size();
+    }
+    return *local;
+}
+
+Stat &stat(const char *name, bool time) {
+    ThreadData &d = data();
+    for (int i=0; i<(int)d.keys.size(); i++)
+        if (d.keys[i]==name || !std::strcmp(d.keys[i], name)) return d.stats[i];
+    d.keys.push_back(name);
+    d.stats.push_back({name, 0, 0, time});
+    return d.stats.back();
+}
+
+}
+
+void enable(bool on) {
+    enabled_.store(on, std::memory_order_relaxed);
+}
+
+void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::unique_ptr<ThreadData> &d : threads) {
+        d->events.clear();
+        d->stats.clear();
+        d->keys.clear();
+    }
+    origin = now();
+}
+
+void event(const char *name, std::int64_t begin, std::int64_t end) {
+    data().events.push_back({name, begin, end});
+    Stat &s = stat(name, true);
+    s.calls++;
+    s.total += end - begin;
+}
+
+void add_time(const char *name, std::int64_t ns) {
+    Stat &s = stat(name, true);
+    s.calls++;
+    s.total += ns;
+}
+
+void count(const char *name, std::int64_t n) {
+    Stat &s = stat(name, false);
+    s.calls++;
+    s.total += n;
+}
+
+std::vector<Stat> stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Stat> all;
+    for (const std::unique_ptr<ThreadData> &d : threads) {
+        for (const Stat &s : d->stats) {
+            auto it = std::find_if(all.begin(), all.end(), [&](const Stat &a) { return a.name==s.name; });
+            if (it==all.end()) {
+                all.push_back(s);
+            } else {
+                it->calls += s.calls;
+                it->total += s.total;
+            }
+        }
+    }
+    std::sort(all.begin(), all.end(), [](const Stat &a, const Stat &b) {
+        return a.time!=b.time ? a.time : a.total > b.total;
+    });
+    return all;
+}
+
+bool write_chrome_trace(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    out << std::fixed << std::setprecision(3);
+    for (const std::unique_ptr<ThreadData> &d : threads) {
+        for (const Event &e : d->events) {
+            out << (first ? "\n" : ",\n");
+            out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << d->tid
+                << ",\"ts\":" << (e.begin - origin)/1e3 << ",\"dur\":" << (e.end - e.begin)/1e3 << "}";
+            first = false;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return out.good();
+}
+
+void print_summary(std::ostream &out) {
+    std::vector<Stat> all = stats();
+    out << std::left << std::setw(20) << "stage" << std::right << std::setw(12) << "calls" << std::setw(14) << "total" << std::setw(14) << "mean" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (const Stat &s : all) {
+        out << std::left << std::setw(20) << s.name << std::right << std::setw(12) << s.calls;
+        if (s.time)
+            out << std::setw(12) << s.total/1e6 << "ms" << std::setw(12) << s.total/1e3/std::max<std::int64_t>(1, s.calls) << "us\n";
+        else
+            out << std::setw(14) << s.total << "\n";
+    }
+}
+
+}
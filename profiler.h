@@ -0,0 +1,62 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+// 分阶段的轻量计时：PROFILE_SCOPE 记录一个区间事件（可导出为 Chrome trace），
+// 高频阶段（逐三角形、逐片段）只累加到命名计数器，不产生事件。
+// 编译期用 TINYRENDERER_PROFILE 开关；编译进来后默认关闭，运行期用 profiler::enable 打开，关闭时每个埋点只有一次原子读
+namespace profiler {
+
+struct Stat {
+    std::string name;
+    std::int64_t calls = 0;
+    std::int64_t total = 0;     // 计时项为纳秒，计数项为累计值
+    bool time = true;
+};
+
+extern std::atomic<bool> enabled_;
+
+inline bool enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+}
+
+inline std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void enable(bool on);
+void reset();
+void event(const char *name, std::int64_t begin, std::int64_t end);
+void add_time(const char *name, std::int64_t ns);
+void count(const char *name, std::int64_t n);
+
+// 以下在没有线程仍在记录时调用
+std::vector<Stat> stats();
+bool write_chrome_trace(const std::string &path);
+void print_summary(std::ostream &out);
+
+}
+
+struct ProfileScope {
+    const char *name;
+    std::int64_t begin;
+    ProfileScope(const char *name) : name(name), begin(profiler::enabled() ? profiler::now() : 0) {}
+    ~ProfileScope() { if (begin) profiler::event(name, begin, profiler::now()); }
+};
+
+#ifdef TINYRENDERER_PROFILE
+#define PROFILE_CONCAT_(a, b)   a##b
+#define PROFILE_CONCAT(a, b)    PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name)     ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_ENABLED()       profiler::enabled()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_ENABLED()       false
+#endif
+
+#endif //__PROFILER_H__
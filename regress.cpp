@@ -0,0 +1,456 @@
+// 回归测试：渲染固定场景，与金标准图像按容差比较，并记录耗时和分阶段计数
+// 历史记录为 JSON Lines，每个场景一行；某个场景比最近几次通过的运行慢出阈值以上时判为失败
+//   tinyrenderer_regress [--golden dir] [--obj file] [--history file] [--threshold 0.2] [--repeat n] [--update] [scene...]
+// 返回值非 0 表示有场景的图像或性能不合格；--update 时重新生成金标准图像
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <cmath>
+#include "render.h"
+#include "shaders.h"
+#include "occlusion.h"
+
+#ifndef TINYRENDERER_SOURCE_DIR
+#define TINYRENDERER_SOURCE_DIR "."
+#endif
+
+namespace {
+
+const int SIZE = 256;                   // 金标准图像的分辨率，够小以便提交到仓库
+
+struct Options {
+    std::string golden  = TINYRENDERER_SOURCE_DIR "/regress";
+    std::string obj     = TINYRENDERER_SOURCE_DIR "/obj/african_head.obj";
+    std::string history = "regress_history.json";
+    float threshold     = .2f;          // 允许的最大变慢比例
+    int   repeat        = 5;            // 取最快的一次，减少噪声
+    int   tolerance     = 2;            // 单通道允许的差值
+    float max_bad       = .001f;        // 超出容差的像素最多占的比例
+    bool  update        = false;
+};
+
+// 场景把图像画进 image/zbuffer；相机矩阵都是局部的
+// 返回 false 表示场景自身的检查没有通过（如剔除的数目不对），与图像比较一样算失败
+typedef std::function<bool(TGAImage &image, float *zbuffer)> Scene;
+
+struct Camera {
+    mat<4,4,float> view, proj, vp;
+    Camera(Vec3f eye, Vec3f center, Vec3f up) {
+        view = lookat(eye, center, up);
+        proj = projection(-1.f/norm(eye - center));
+        vp   = viewport(SIZE/8, SIZE/8, SIZE*3/4, SIZE*3/4);
+    }
+};
+
+Scene head_scene(Model *model, const std::string &shader, bool shadows, ShadingRate rate = ShadingRate::R1x1) {
+    return [=](TGAImage &image, float *zbuffer) {
+        Camera cam(Vec3f(1,1,3), Vec3f(0,0,0), Vec3f(0,1,0));
+        Vec3f light = normalized(Vec3f(1,1,1));
+        std::unique_ptr<ShadowMap> shadow;
+        if (shadows) {
+            shadow = std::make_unique<ShadowMap>(SIZE, SIZE);
+            shadow->transform = cam.vp*projection(0)*lookat(light, Vec3f(0,0,0), Vec3f(0,1,0));
+            draw_model_shadow(*model, *shadow, identity<4>());
+        }
+        std::unique_ptr<GouraudShader> s;
+        if (shader=="texture") s = std::make_unique<TextureShader>(model, light, shadow.get());
+        else s = std::make_unique<GouraudShader>(light, shadow.get());
+        s->bind(identity<4>(), cam.vp*cam.proj*cam.view);
+        s->rate = rate;
+        draw_model(*model, *s, image, zbuffer);
+        return true;
+    };
+}
+
+// 均匀缩放 k 后平移到 p
+mat<4,4,float> place(Vec3f p, float k) {
+    return {{{k,0,0,p.x}, {0,k,0,p.y}, {0,0,k,p.z}, {0,0,0,1}}};
+}
+
+// 实例化：屏幕内 3x3 个缩小的头像，另有 4 个在视野两侧、上方和相机后面，须恰好剔除这 4 个
+Scene instanced_scene(Model *model) {
+    return [=](TGAImage &image, float *zbuffer) {
+        Camera cam(Vec3f(0,0,4), Vec3f(0,0,0), Vec3f(0,1,0));
+        std::vector<mat<4,4,float> > instances;
+        for (int j=-1; j<=1; j++)
+            for (int i=-1; i<=1; i++) instances.push_back(place(Vec3f(i*.7f, j*.7f, 0), .3f));
+        for (Vec3f p : {Vec3f(6,0,0), Vec3f(-6,0,0), Vec3f(0,6,0), Vec3f(0,0,20)}) instances.push_back(place(p, .3f));
+        GouraudShader shader(normalized(Vec3f(1,1,1)));
+        int visible = draw_instanced(*model, instances, shader, image, zbuffer, cam.proj, cam.view, cam.vp);
+        if (visible != 9) std::cerr << "instanced: " << visible << " visible instances, expected 9" << std::endl;
+        return visible==9;
+    };
+}
+
+// 非正方形视口下的实例化：视口高是宽的 4 倍并超出画面上下边缘，一列头像从边缘内外穿过；
+// 剔除后的图像须与不剔除、逐个绘制全部实例的图像相同，并且确实剔除了完全在画面外的实例
+Scene instanced_tall_scene(Model *model) {
+    return [=](TGAImage &image, float *zbuffer) {
+        Camera cam(Vec3f(0,0,4), Vec3f(0,0,0), Vec3f(0,1,0));
+        cam.vp = viewport(SIZE/4, -SIZE/2, SIZE/2, SIZE*2);
+        std::vector<mat<4,4,float> > instances;
+        for (int j=-7; j<=7; j++) instances.push_back(place(Vec3f(0, j*.3f, 0), .3f));
+        GouraudShader shader(normalized(Vec3f(1,1,1)));
+        int visible = draw_instanced(*model, instances, shader, image, zbuffer, cam.proj, cam.view, cam.vp);
+
+        TGAImage check(SIZE, SIZE, TGAImage::RGB);
+        std::vector<float> check_z(SIZE*SIZE, -std::numeric_limits<float>::max());
+        for (const mat<4,4,float> &M : instances) {
+            shader.bind(M, cam.vp*cam.proj*cam.view);
+            draw_model(*model, shader, check, check_z.data());
+        }
+        bool same = !std::memcmp(check.buffer(), image.buffer(), size_t(SIZE)*SIZE*image.bytespp());
+        bool culled = visible < (int)instances.size();
+        if (!same || !culled)
+            std::cerr << "instanced_tall: " << visible << " of " << instances.size() << " visible"
+                      << (same ? "" : ", culled instances would have been visible") << std::endl;
+        return same && culled;
+    };
+}
+
+// 遮挡剔除：近处一个大头像作遮挡体，正后方 4 个缩小的头像须整个被剔除，两侧 2 个露在外面的须照常绘制；
+// 被剔除的物体不剔除地再画一遍到副本里，图像不能有任何变化，即剔除是保守的
+Scene occlusion_scene(Model *model) {
+    return [=](TGAImage &image, float *zbuffer) {
+        Camera cam(Vec3f(0,0,4), Vec3f(0,0,0), Vec3f(0,1,0));
+        const mat<4,4,float> camera = cam.vp*cam.proj*cam.view;
+        GouraudShader shader(normalized(Vec3f(1,1,1)));
+        shader.bind(identity<4>(), camera);
+        OcclusionBuffer occ(SIZE/4, SIZE/4, SIZE, SIZE, camera);
+        occ.add_occluder(*model);
+        draw_model(*model, shader, image, zbuffer);
+
+        int hidden = 0, shown = 0;
+        const Vec3f behind[] = {Vec3f(0,0,-2), Vec3f(0,.15f,-2), Vec3f(0,-.3f,-2), Vec3f(.1f,0,-4)};
+        for (Vec3f p : behind) {
+            shader.bind(place(p, .2f), camera);
+            hidden += draw_model_occluded(*model, shader, image, zbuffer, occ) > 0;
+        }
+        TGAImage check = image;
+        std::vector<float> check_z(zbuffer, zbuffer + SIZE*SIZE);
+        for (Vec3f p : behind) {
+            shader.bind(place(p, .2f), camera);
+            draw_model(*model, shader, check, check_z.data());
+        }
+        bool conservative = !std::memcmp(check.buffer(), image.buffer(), size_t(SIZE)*SIZE*image.bytespp());
+        for (Vec3f p : {Vec3f(-1.6f,0,-1), Vec3f(1.6f,0,-1)}) {
+            shader.bind(place(p, .25f), camera);
+            shown += draw_model_occluded(*model, shader, image, zbuffer, occ) > 0;
+        }
+        if (hidden || shown != 2 || !conservative)
+            std::cerr << "occlusion: " << hidden << " hidden objects drawn, " << shown << " of 2 visible objects drawn"
+                      << (conservative ? "" : ", culled objects would have been visible") << std::endl;
+        return !hidden && shown==2 && conservative;
+    };
+}
+
+// 模型矩阵不是单位阵时的阴影：一个绕 y 轴转过的头像，被它和光源之间另一个缩小的头像投下阴影；
+// 阴影贴图用各自的模型矩阵绘制，着色器查询的是同一个世界坐标
+Scene shadow_transformed_scene(Model *model) {
+    return [=](TGAImage &image, float *zbuffer) {
+        Camera cam(Vec3f(1,1,3), Vec3f(0,0,0), Vec3f(0,1,0));
+        Vec3f light = normalized(Vec3f(1,1,1));
+        const float c = std::cos(.6f), s = std::sin(.6f);
+        mat<4,4,float> turned = {{{.8f*c,0,.8f*s,-.2f}, {0,.8f,0,-.1f}, {-.8f*s,0,.8f*c,0}, {0,0,0,1}}};
+        mat<4,4,float> caster = place(Vec3f(.45f,.5f,.55f), .3f);
+        ShadowMap shadow(SIZE, SIZE);
+        shadow.transform = cam.vp*projection(0)*lookat(light, Vec3f(0,0,0), Vec3f(0,1,0));
+        draw_model_shadow(*model, shadow, turned);
+        draw_model_shadow(*model, shadow, caster);
+        GouraudShader shader(light, &shadow);
+        for (const mat<4,4,float> &M : {turned, caster}) {
+            shader.bind(M, cam.vp*cam.proj*cam.view);
+            draw_model(*model, shader, image, zbuffer);
+        }
+        return true;
+    };
+}
+
+// 切线空间法线贴图：仓库里没有 _nm_tangent.tga，把模型和漫反射贴图复制到临时目录，旁边写一张程序生成的起伏贴图。
+// 以 ModelOptions::tangents 加载两次：第一次计算切线并写出 _tangents.bin，第二次须命中缓存（不重写文件），两次的图像须逐字节相同
+Scene normalmap_scene(const std::string &obj) {
+    namespace fs = std::filesystem;
+    std::shared_ptr<Model> computed, cached;
+    std::string error;
+    fs::path dir = fs::temp_directory_path() / "tinyrenderer_regress_nm";
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    fs::create_directories(dir, ec);
+    fs::path src(obj), dst = dir / src.filename();
+    std::string stem = (dir / src.stem()).string();
+    fs::copy_file(src, dst, ec);
+    if (!ec) fs::copy_file(src.parent_path() / (src.stem().string() + "_diffuse.tga"), stem + "_diffuse.tga", ec);
+    TGAImage nm(256, 256, TGAImage::RGB);
+    for (int y=0; y<nm.height(); y++) {
+        for (int x=0; x<nm.width(); x++) {
+            Vec3f n = normalized(Vec3f(.5f*std::sin(x*.4f), .5f*std::sin(y*.4f), 1));
+            nm.set(x, y, TGAColor{{std::uint8_t((n.z*.5f + .5f)*255), std::uint8_t((n.y*.5f + .5f)*255), std::uint8_t((n.x*.5f + .5f)*255), 255}});
+        }
+    }
+    if (ec || !nm.write_tga_file(stem + "_nm_tangent.tga")) {
+        error = "can't prepare " + dir.string();
+    } else {
+        ModelOptions options;
+        options.textures = TextureLoad::Eager;
+        options.tangents = true;
+        std::string cachefile = stem + "_tangents.bin";
+        computed = std::make_shared<Model>(dst.string().c_str(), options);
+        fs::file_time_type written = fs::last_write_time(cachefile, ec);
+        if (ec) error = "no tangent cache written";
+        else {
+            cached = std::make_shared<Model>(dst.string().c_str(), options);
+            if (fs::last_write_time(cachefile) != written) error = "tangent cache was rewritten instead of read";
+        }
+        if (error.empty() && (!computed->has_tangents() || !cached->has_tangents())) error = "model has no tangents";
+    }
+    fs::remove_all(dir, ec);                            // 贴图已经 Eager 读入，网格也已解析完
+
+    return [=](TGAImage &image, float *zbuffer) {
+        if (!error.empty()) {
+            std::cerr << "normalmap: " << error << std::endl;
+            return false;
+        }
+        Camera cam(Vec3f(1,1,3), Vec3f(0,0,0), Vec3f(0,1,0));
+        Vec3f light = normalized(Vec3f(1,1,1));
+        NormalMapShader shader(computed.get(), light);
+        shader.bind(identity<4>(), cam.vp*cam.proj*cam.view);
+        draw_model(*computed, shader, image, zbuffer);
+
+        TGAImage check(SIZE, SIZE, TGAImage::RGB);
+        std::vector<float> check_z(SIZE*SIZE, -std::numeric_limits<float>::max());
+        NormalMapShader from_cache(cached.get(), light);
+        from_cache.bind(identity<4>(), cam.vp*cam.proj*cam.view);
+        draw_model(*cached, from_cache, check, check_z.data());
+        bool same = !std::memcmp(check.buffer(), image.buffer(), size_t(SIZE)*SIZE*image.bytespp());
+        if (!same) std::cerr << "normalmap: render with cached tangents differs" << std::endl;
+        return same;
+    };
+}
+
+// 合成的三角形汤，直接送入 triangle()
+struct Soup {
+    std::vector<Vec3f> verts, norms;    // 每 3 个一组
+};
+
+// 确定性的伪随机数，保证每次生成同样的网格
+struct Lcg {
+    unsigned state;
+    Lcg(unsigned seed) : state(seed) {}
+    float operator()() {
+        state = state*1664525u + 1013904223u;
+        return (state >> 8)*(1.f/16777216.f);
+    }
+};
+
+// 大量约一个像素大小的三角形：压测三角形建立和小包围盒
+Soup tiny_soup() {
+    Soup soup;
+    const int n = 160;
+    float cell = 2.f/n;
+    for (int j=0; j<n; j++) {
+        for (int i=0; i<n; i++) {
+            float x = -1 + i*cell, y = -1 + j*cell;
+            float z = .5f*std::sin(x*3)*std::cos(y*3);
+            Vec3f p[4] = {Vec3f(x, y, z), Vec3f(x+cell, y, z), Vec3f(x+cell, y+cell, z), Vec3f(x, y+cell, z)};
+            Vec3f nrm = normalized(Vec3f(-1.5f*std::cos(x*3)*std::cos(y*3), 1.5f*std::sin(x*3)*std::sin(y*3), 1));
+            for (int k : {0, 1, 2, 0, 2, 3}) {
+                soup.verts.push_back(p[k]);
+                soup.norms.push_back(nrm);
+            }
+        }
+    }
+    return soup;
+}
+
+// 少量覆盖大半屏幕、深度交错的大三角形：压测逐像素循环和深度测试
+Soup large_soup() {
+    Soup soup;
+    Lcg rnd(12345);
+    for (int t=0; t<96; t++) {
+        Vec3f nrm = normalized(Vec3f(rnd()-.5f, rnd()-.5f, 1));
+        for (int k=0; k<3; k++) {
+            soup.verts.push_back(Vec3f(rnd()*4-2, rnd()*4-2, rnd()*2-1));
+            soup.norms.push_back(nrm);
+        }
+    }
+    return soup;
+}
+
+Scene soup_scene(std::shared_ptr<Soup> soup) {
+    return [=](TGAImage &image, float *zbuffer) {
+        Camera cam(Vec3f(0,0,3), Vec3f(0,0,0), Vec3f(0,1,0));
+        GouraudShader shader(normalized(Vec3f(1,1,1)));
+        shader.bind(identity<4>(), cam.vp*cam.proj*cam.view);
+        for (size_t i=0; i+2<soup->verts.size(); i+=3) {
+            Vec4f clip[3];
+            Vec2f uvs[3];
+            for (int j=0; j<3; j++) clip[j] = shader.vertex(soup->verts[i+j], soup->norms[i+j], j);
+            triangle(clip, uvs, shader, image, zbuffer);
+        }
+        return true;
+    };
+}
+
+// 按容差比较；返回超出容差的像素数，max_diff 输出最大的单通道差值
+int compare(const TGAImage &a, const TGAImage &b, int tolerance, int &max_diff) {
+    max_diff = 0;
+    int bad = 0;
+    for (int y=0; y<a.height(); y++) {
+        for (int x=0; x<a.width(); x++) {
+            TGAColor ca = a.get(x, y), cb = b.get(x, y);
+            int d = 0;
+            for (int c=0; c<a.bytespp(); c++) d = std::max(d, std::abs(int(ca.bgra[c]) - int(cb.bgra[c])));
+            max_diff = std::max(max_diff, d);
+            if (d > tolerance) bad++;
+        }
+    }
+    return bad;
+}
+
+// 读历史记录里该场景最近 n 次的耗时，取中位数作为基线；没有记录时返回 0
+double baseline_ms(const std::string &history, const std::string &scene, int n=5) {
+    std::ifstream in(history);
+    std::string line, key = "\"scene\": \"" + scene + "\"";
+    std::vector<double> times;
+    while (std::getline(in, line)) {
+        if (line.find(key)==std::string::npos) continue;
+        size_t pos = line.find("\"ms\": ");
+        if (pos!=std::string::npos) times.push_back(std::atof(line.c_str() + pos + 6));
+    }
+    if (times.empty()) return 0;
+    if ((int)times.size() > n) times.erase(times.begin(), times.end()-n);
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    std::vector<std::string> only;
+    for (int i=1; i<argc; i++) {
+        std::string a = argv[i];
+        if      (a=="--golden"    && i+1<argc) opt.golden = argv[++i];
+        else if (a=="--obj"       && i+1<argc) opt.obj = argv[++i];
+        else if (a=="--history"   && i+1<argc) opt.history = argv[++i];
+        else if (a=="--threshold" && i+1<argc) opt.threshold = std::atof(argv[++i]);
+        else if (a=="--repeat"    && i+1<argc) opt.repeat = std::max(1, std::atoi(argv[++i]));
+        else if (a=="--update") opt.update = true;
+        else if (a.compare(0, 2, "--")) only.push_back(a);
+        else {
+            std::cerr << "unknown option " << a << std::endl;
+            return 2;
+        }
+    }
+
+    // 不做网格优化以外的加载期处理；不建 LOD，保证每次渲染同一份网格
+    ModelOptions options;
+    options.textures = TextureLoad::Eager;
+    Model model(opt.obj.c_str(), options);
+    if (!model.nfaces()) {
+        std::cerr << "can't load " << opt.obj << std::endl;
+        return 2;
+    }
+
+    std::vector<std::pair<std::string, Scene> > scenes = {
+        {"head_gouraud",        head_scene(&model, "gouraud", false)},
+        {"head_gouraud_shadow", head_scene(&model, "gouraud", true)},
+        {"head_texture",        head_scene(&model, "texture", false)},
+        {"head_texture_shadow", head_scene(&model, "texture", true)},
+        {"head_texture_2x2",    head_scene(&model, "texture", true, ShadingRate::R2x2)},
+        {"stress_tiny",         soup_scene(std::make_shared<Soup>(tiny_soup()))},
+        {"stress_large",        soup_scene(std::make_shared<Soup>(large_soup()))},
+        {"instanced_grid",      instanced_scene(&model)},
+        {"instanced_tall",      instanced_tall_scene(&model)},
+        {"occlusion_cull",      occlusion_scene(&model)},
+        {"head_normalmap",      normalmap_scene(opt.obj)},
+        {"shadow_transformed",  shadow_transformed_scene(&model)},
+    };
+
+    std::ostringstream record;
+    long long run = std::time(NULL);
+    int failures = 0;
+    for (auto &[name, scene] : scenes) {
+        if (!only.empty() && std::find(only.begin(), only.end(), name)==only.end()) continue;
+
+        // 计时的几次关闭埋点，最后再开着埋点跑一次取分阶段计数
+        TGAImage image;
+        double best = 1e30;
+        bool checks_ok = true;
+        for (int r=0; r<=opt.repeat; r++) {
+            bool counted = r==opt.repeat;
+            image = TGAImage(SIZE, SIZE, TGAImage::RGB);
+            std::vector<float> zbuffer(SIZE*SIZE, -std::numeric_limits<float>::max());
+            profiler::reset();
+            profiler::enable(counted);
+            std::int64_t t0 = profiler::now();
+            checks_ok = scene(image, zbuffer.data()) && checks_ok;
+            if (!counted) best = std::min(best, (profiler::now() - t0)/1e6);
+        }
+        profiler::enable(false);
+        std::vector<profiler::Stat> stats = profiler::stats();
+
+        // 图像经过一次 TGA 编码和解码再比较，编解码器的改动也会被发现
+        std::string golden = opt.golden + "/" + name + ".tga";
+        if (opt.update) {
+            if (!image.write_tga_file(golden)) {
+                std::cerr << "can't write " << golden << std::endl;
+                return 2;
+            }
+            std::cout << name << ": golden updated" << std::endl;
+            continue;
+        }
+        std::string tmp = name + ".out.tga";
+        TGAImage expected, actual;
+        bool ok = expected.read_tga_file(golden);
+        if (!ok) {
+            std::cout << name << ": FAIL missing golden " << golden << " (run with --update)" << std::endl;
+            failures++;
+            continue;
+        }
+        image.write_tga_file(tmp);
+        actual.read_tga_file(tmp);
+        int max_diff = 0, bad = -1;
+        if (actual.width()==expected.width() && actual.height()==expected.height())
+            bad = compare(actual, expected, opt.tolerance, max_diff);
+        bool image_ok = bad >= 0 && bad <= opt.max_bad*SIZE*SIZE && checks_ok;
+        if (image_ok) std::remove(tmp.c_str());
+
+        double base = baseline_ms(opt.history, name);
+        bool perf_ok = base <= 0 || best <= base*(1 + opt.threshold);
+
+        std::cout << name << ": " << (image_ok && perf_ok ? "ok" : "FAIL")
+                  << "  " << best << " ms";
+        if (base > 0) std::cout << " (baseline " << base << " ms, " << (best/base - 1)*100 << "%)";
+        std::cout << "  bad pixels " << bad << " max diff " << max_diff;
+        if (!image_ok) std::cout << "  see " << tmp;
+        std::cout << std::endl;
+        if (!image_ok || !perf_ok) {
+            failures++;
+            continue;
+        }
+
+        // 只记录通过的运行，退化的结果不会拉低后续的基线
+        record << "{\"run\": " << run << ", \"scene\": \"" << name << "\", \"ms\": " << best;
+        for (const profiler::Stat &s : stats) {
+            if (s.time) record << ", \"" << s.name << "_ms\": " << s.total/1e6;
+            else        record << ", \"" << s.name << "\": " << s.total;
+        }
+        record << "}\n";
+    }
+
+    if (!opt.update) {
+        std::ofstream out(opt.history, std::ios::app);
+        out << record.str();
+    }
+    if (failures) std::cout << failures << " scene(s) failed" << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+#ifndef __RENDER_H__
+#define __RENDER_H__
+#include <vector>
+#include "gl.h"
+#include "model.h"
+
+// 把模型的 [begin, end) 面依次送入顶点着色器和光栅化
+inline void draw_faces(Model &model, int begin, int end, IShader &shader, TGAImage &image, float *zbuffer) {
+    const bool timed = PROFILE_ENABLED();
+    std::int64_t t_vertex = 0;
+    shader.prepare();
+    for (int i=begin; i<end; i++) {                         // 遍历三角面
+        Vec4f clip_coords[3];
+        Vec2f uvs[3];
+        std::int64_t t0 = timed ? profiler::now() : 0;
+        shader.iface = i;
+        for (int j=0; j<3; j++) {                           // 遍历三角面顶点
+            clip_coords[j] = shader.vertex(model.vert(i, j), model.normal(i, j), j);
+            uvs[j] = model.uv(i, j);
+        }
+        if (timed) t_vertex += profiler::now() - t0;
+        triangle(clip_coords, uvs, shader, image, zbuffer); // 光栅化
+    }
+    if (timed) {
+        profiler::add_time("vertex", t_vertex);
+        profiler::count("triangles", end - begin);
+    }
+}
+
+inline void draw_model(Model &model, IShader &shader, TGAImage &image, float *zbuffer) {
+    draw_faces(model, 0, model.nfaces(), shader, image, zbuffer);
+}
+
+// 把经模型矩阵 M 摆放的模型画进阴影贴图
+inline void draw_model_shadow(Model &model, ShadowMap &shadow, const mat<4,4,float> &M) {
+    for (int i=0; i<model.nfaces(); i++) {
+        Vec3f verts[3];
+        for (int j=0; j<3; j++) verts[j] = model.vert(i, j);
+        shadow.draw(verts, M);
+    }
+}
+
+// 经模型矩阵 M 变换后的包围球是否与屏幕相交；radius_px 非空时输出包围球在屏幕上的半径（像素）
+inline bool sphere_visible(const mat<4,4,float> &M, Vec3f center, float radius, int width, int height,
+                           const mat<4,4,float> &proj, const mat<4,4,float> &view, const mat<4,4,float> &vp, float *radius_px = NULL) {
+    // 包围球半径按矩阵最大的轴向缩放放大
+    float scale = 0;
+    for (int j=0; j<3; j++) scale = std::max(scale, Vec3f(M[0][j], M[1][j], M[2][j])*Vec3f(M[0][j], M[1][j], M[2][j]));
+    radius *= std::sqrt(scale);
+
+    Vec4f c = vp*proj*view*(M*Vec4f(center.x, center.y, center.z, 1));
+    float dw = radius*std::abs(proj[3][2]);                 // 包围球在 w 方向上的跨度
+    if (c.w + dw <= 0) return false;                        // 整个在相机后面
+    if (c.w - dw <= 0) {                                    // 跨过相机平面，保守地认为可见且很大
+        if (radius_px) *radius_px = std::numeric_limits<float>::max();
+        return true;
+    }
+
+    // 视口两个方向的缩放可以不同，x、y 各按自己的缩放求屏幕半径
+    float kx = std::abs(vp[0][0]), ky = std::abs(vp[1][1]);
+    float rx = radius*kx/(c.w - dw), ry = radius*ky/(c.w - dw);
+    float sx = c.x/c.w, sy = c.y/c.w;
+    if (radius_px) *radius_px = radius*std::max(kx, ky)/c.w;
+    return sx + rx >= 0 && sy + ry >= 0 && sx - rx < width && sy - ry < height;
+}
+
+inline bool sphere_visible(const mat<4,4,float> &M, Vec3f center, float radius, int width, int height, float *radius_px = NULL) {
+    return sphere_visible(M, center, radius, width, height, Projection, ModelView, Viewport, radius_px);
+}
+
+// 实例化绘制：所有实例共享 model 的顶点、索引和纹理，只有模型矩阵不同
+// 逐实例做包围球剔除，若 model 建了 LOD 则按实例的屏幕尺寸选一级，可见实例在同一个光栅 pass 中写入 image/zbuffer
+// 相机由 proj/view/vp 给出；返回可见的实例数，着色器的绑定状态在返回时恢复
+inline int draw_instanced(Model &model, const std::vector<mat<4,4,float> > &instances, IShader &shader, TGAImage &image, float *zbuffer,
+                          const mat<4,4,float> &proj, const mat<4,4,float> &view, const mat<4,4,float> &vp) {
+    int visible = 0;
+    Vec3f center = model.center();
+    float radius = model.radius();
+    const bool bound = shader.bound;
+    const mat<4,4,float> M0 = shader.uniform_M, MVP0 = shader.uniform_MVP, N0 = shader.uniform_N;
+    const mat<4,4,float> camera = vp*proj*view;
+    for (const mat<4,4,float> &M : instances) {
+        float radius_px = 0;
+        if (!sphere_visible(M, center, radius, image.width(), image.height(), proj, view, vp, &radius_px)) continue;
+        visible++;
+        shader.bind(M, camera);
+        draw_model(*model.lod_for(radius_px), shader, image, zbuffer);
+    }
+    shader.uniform_M = M0;
+    shader.uniform_MVP = MVP0;
+    shader.uniform_N = N0;
+    shader.bound = bound;
+    if (PROFILE_ENABLED()) profiler::count("instances_culled", instances.size() - visible);
+    return visible;
+}
+
+// 用全局相机
+inline int draw_instanced(Model &model, const std::vector<mat<4,4,float> > &instances, IShader &shader, TGAImage &image, float *zbuffer) {
+    return draw_instanced(model, instances, shader, image, zbuffer, Projection, ModelView, Viewport);
+}
+
+#endif //__RENDER_H__
@@ -0,0 +1,397 @@
+// 常驻的渲染服务：模型和纹理只加载一次，之后每个请求只付出渲染本身的时间
+//
+// 请求为一行一个 JSON 对象，从标准输入读，或者用 --socket <path> 监听 Unix 域套接字：
+//   {"id": 1, "model": "obj/african_head.obj", "output": "out.tga", "width": 800, "height": 800,
+//    "camera": [1,1,3], "center": [0,0,0], "up": [0,1,0], "light": [1,1,1], "shader": "gouraud", "shadows": true, "rate": "1x1"}
+// 除 model 和 output 外都有默认值；shader 为 "gouraud" 或 "texture"，rate 为着色率 "1x1"、"1x2"、"2x2" 或 "4x4"
+// 每个请求回复一行：{"id": 1, "ok": true, "render_ms": 12.3} 或 {"id": 1, "ok": false, "error": "..."}
+// 模型第一次被请求时加载，回复中附带 load_ms
+// width*height 超过 --max-size（默认 4096x4096）的像素数时拒绝请求，防止一个请求占满内存
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <csignal>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <memory>
+#include <functional>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "render.h"
+#include "shaders.h"
+#include "texcache.h"
+#include "jobs.h"
+
+namespace {
+
+// ---- 只支持请求用到的 JSON 子集：一层对象，值为字符串、数字、布尔或数字数组 ----
+
+struct JsonValue {
+    std::string raw;                    // 原始文本，用于原样回显 id
+    std::string str;
+    std::vector<double> nums;           // 数字、布尔（0/1）或数字数组
+    bool is_string = false;
+};
+
+void skip_ws(const char *&p) {
+    while (*p==' ' || *p=='\t' || *p=='\r' || *p=='\n') p++;
+}
+
+bool parse_string(const char *&p, std::string &out) {
+    if (*p!='"') return false;
+    out.clear();
+    for (p++; *p && *p!='"'; p++) {
+        if (*p=='\\') {
+            p++;
+            switch (*p) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case '\0': return false;
+                default:  out += *p;
+            }
+        } else {
+            out += *p;
+        }
+    }
+    if (*p!='"') return false;
+    p++;
+    return true;
+}
+
+bool parse_scalar(const char *&p, std::vector<double> &nums) {
+    if (!strncmp(p, "true", 4))  { p += 4; nums.push_back(1); return true; }
+    if (!strncmp(p, "false", 5)) { p += 5; nums.push_back(0); return true; }
+    if (!strncmp(p, "null", 4))  { p += 4; return true; }
+    char *end;
+    double v = std::strtod(p, &end);
+    if (end==p) return false;
+    nums.push_back(v);
+    p = end;
+    return true;
+}
+
+bool parse_value(const char *&p, JsonValue &v) {
+    const char *begin = p;
+    if (*p=='"') {
+        v.is_string = true;
+        if (!parse_string(p, v.str)) return false;
+    } else if (*p=='[') {
+        p++;
+        skip_ws(p);
+        while (*p!=']') {
+            if (!parse_scalar(p, v.nums)) return false;
+            skip_ws(p);
+            if (*p==',') p++;
+            else if (*p!=']') return false;
+            skip_ws(p);
+        }
+        p++;
+    } else if (!parse_scalar(p, v.nums)) {
+        return false;
+    }
+    v.raw.assign(begin, p);
+    return true;
+}
+
+bool parse_object(const std::string &line, std::map<std::string, JsonValue> &obj) {
+    const char *p = line.c_str();
+    skip_ws(p);
+    if (*p!='{') return false;
+    p++;
+    skip_ws(p);
+    while (*p!='}') {
+        std::string key;
+        if (!parse_string(p, key)) return false;
+        skip_ws(p);
+        if (*p!=':') return false;
+        p++;
+        skip_ws(p);
+        if (!parse_value(p, obj[key])) return false;
+        skip_ws(p);
+        if (*p==',') p++;
+        else if (*p!='}') return false;
+        skip_ws(p);
+    }
+    return true;
+}
+
+std::string quote(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c=='"' || c=='\\') out += '\\';
+        if (c=='\n') { out += "\\n"; continue; }
+        out += c;
+    }
+    return out + "\"";
+}
+
+// ---- 请求 ----
+
+// 单个请求允许的最大像素数：颜色、深度和阴影缓冲都与它成正比，像素下标也须放得进 int
+std::int64_t max_pixels = 4096*4096;
+
+struct RenderRequest {
+    std::string id = "null";
+    std::string model, output;
+    std::string shader = "gouraud";
+    bool shadows = true;
+    ShadingRate rate = ShadingRate::R1x1;
+    int width = 800, height = 800;
+    Vec3f camera = Vec3f(1,1,3), center = Vec3f(0,0,0), up = Vec3f(0,1,0), light = Vec3f(1,1,1);
+};
+
+bool parse_request(const std::string &line, RenderRequest &req, std::string &error) {
+    std::map<std::string, JsonValue> obj;
+    if (!parse_object(line, obj)) {
+        error = "malformed JSON";
+        return false;
+    }
+    if (obj.count("id")) req.id = obj["id"].raw;
+    for (const auto &[key, v] : obj) {
+        if (key=="id") continue;
+        if (key=="model" || key=="output" || key=="shader") {
+            if (!v.is_string) { error = key + " must be a string"; return false; }
+            (key=="model" ? req.model : key=="output" ? req.output : req.shader) = v.str;
+        } else if (key=="rate") {
+            if (!v.is_string || !parse_shading_rate(v.str, req.rate)) { error = "rate must be 1x1, 1x2, 2x2 or 4x4"; return false; }
+        } else if (key=="width" || key=="height" || key=="shadows") {
+            if (v.is_string || v.nums.size()!=1) { error = key + " must be a number"; return false; }
+            if (key=="shadows") req.shadows = v.nums[0]!=0;
+            else (key=="width" ? req.width : req.height) = int(v.nums[0]);
+        } else if (key=="camera" || key=="center" || key=="up" || key=="light") {
+            if (v.is_string || v.nums.size()!=3) { error = key + " must be an array of 3 numbers"; return false; }
+            Vec3f &dst = key=="camera" ? req.camera : key=="center" ? req.center : key=="up" ? req.up : req.light;
+            dst = Vec3f(v.nums[0], v.nums[1], v.nums[2]);
+        } else {
+            error = "unknown field " + key;
+            return false;
+        }
+    }
+    if (req.model.empty() || req.output.empty()) {
+        error = "model and output are required";
+        return false;
+    }
+    if (req.width<=0 || req.height<=0 || req.width>TGA_MAX_SIZE || req.height>TGA_MAX_SIZE) {
+        error = "bad resolution";
+        return false;
+    }
+    if (std::int64_t(req.width)*req.height > max_pixels) {
+        error = "resolution exceeds " + std::to_string(max_pixels) + " pixels";
+        return false;
+    }
+    if (req.shader!="gouraud" && req.shader!="texture") {
+        error = "unknown shader " + req.shader;
+        return false;
+    }
+    return true;
+}
+
+// ---- 常驻模型：按路径只加载一次，并发请求同一个模型时等待同一次加载 ----
+
+class ModelStore {
+public:
+    ModelOptions options;
+    std::string lod_cache;              // 非空时 LOD 缓存在这个目录里
+
+    // loaded 输出本次调用是否触发了加载
+    std::shared_ptr<Model> get(const std::string &path, bool &loaded) {
+        std::shared_future<std::shared_ptr<Model> > f;
+        std::promise<std::shared_ptr<Model> > promise;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = models_.find(path);
+            loaded = it==models_.end();
+            if (loaded) it = models_.emplace(path, promise.get_future().share()).first;
+            f = it->second;
+        }
+        if (loaded) {
+            std::shared_ptr<Model> m = std::make_shared<Model>(path.c_str(), options);
+            if (m->nfaces()) m->build_lods(4, .5f, lod_cache);
+            else m.reset();
+            promise.set_value(m);
+            if (!m) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                models_.erase(path);                        // 失败的加载不缓存，文件修好后可以重试
+            }
+        }
+        return jobs::wait(f);                               // 等待别的请求触发的加载时执行线程池里的任务
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, std::shared_future<std::shared_ptr<Model> > > models_;
+};
+
+// 返回空字符串表示成功
+std::string render(const RenderRequest &req, ModelStore &store, double &render_ms, double &load_ms) {
+    std::int64_t t0 = profiler::now();
+    bool loaded;
+    std::shared_ptr<Model> model = store.get(req.model, loaded);
+    if (!model) return "can't load model " + req.model;
+    std::int64_t t1 = profiler::now();
+    load_ms = loaded ? (t1 - t0)/1e6 : 0;
+
+    // 相机矩阵都是局部的，不碰 gl.h 里的全局变量
+    int w = req.width, h = req.height;
+    mat<4,4,float> view = lookat(req.camera, req.center, req.up);
+    mat<4,4,float> proj = projection(-1.f/norm(req.camera - req.center));
+    mat<4,4,float> vp   = viewport(w/8, h/8, w*3/4, h*3/4);
+    Vec3f light = normalized(req.light);
+    Model *mesh = model->lod_for(projected_radius(model->center(), model->radius(), proj, view, vp));
+
+    std::unique_ptr<ShadowMap> shadow;
+    if (req.shadows) {
+        shadow = std::make_unique<ShadowMap>(w, h);
+        shadow->transform = vp*projection(0)*lookat(light, req.center, req.up);
+        draw_model_shadow(*mesh, *shadow, identity<4>());
+    }
+
+    TGAImage image(w, h, TGAImage::RGB);
+    std::vector<float> zbuffer(size_t(w)*h, -std::numeric_limits<float>::max());
+    std::unique_ptr<GouraudShader> shader;
+    if (req.shader=="texture") shader = std::make_unique<TextureShader>(model.get(), light, shadow.get());
+    else shader = std::make_unique<GouraudShader>(light, shadow.get());
+    shader->bind(identity<4>(), vp*proj*view);
+    shader->rate = req.rate;
+    draw_model(*mesh, *shader, image, zbuffer.data());
+    image.flip_vertically();
+    bool ok = image.write_tga_file(req.output);
+    render_ms = (profiler::now() - t1)/1e6;
+    return ok ? "" : "can't write " + req.output;
+}
+
+// ---- 传输：回复写回请求来源；套接字连接在最后一个回复写完后关闭 ----
+
+struct Client {
+    int fd;
+    bool owned;                         // 标准输出不关闭
+    std::mutex mutex;
+
+    Client(int fd, bool owned) : fd(fd), owned(owned) {}
+    ~Client() { if (owned) close(fd); }
+
+    void reply(const std::string &line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const char *p = line.c_str();
+        size_t left = line.size();
+        while (left) {
+            ssize_t n = write(fd, p, left);
+            if (n<=0) return;           // 对端已断开，丢弃回复
+            p += n;
+            left -= n;
+        }
+    }
+};
+
+// 请求在共享的线程池里执行，一次渲染内部的并行（纹理解码、OBJ 解析、TGA 编码）也用同一批线程
+void submit(const std::string &line, const std::shared_ptr<Client> &client, ModelStore &store, jobs::TaskGroup &requests) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) return;
+    RenderRequest req;
+    std::string error;
+    if (!parse_request(line, req, error)) {
+        client->reply("{\"id\": " + req.id + ", \"ok\": false, \"error\": " + quote(error) + "}\n");
+        return;
+    }
+    requests.run([req, client, &store] {
+        double render_ms = 0, load_ms = 0;
+        std::string error = render(req, store, render_ms, load_ms);
+        std::string reply = "{\"id\": " + req.id;
+        if (error.empty()) {
+            reply += ", \"ok\": true, \"render_ms\": " + std::to_string(render_ms);
+            if (load_ms > 0) reply += ", \"load_ms\": " + std::to_string(load_ms);
+        } else {
+            reply += ", \"ok\": false, \"error\": " + quote(error);
+        }
+        client->reply(reply + "}\n");
+    });
+}
+
+void serve_connection(int fd, ModelStore &store, jobs::TaskGroup &requests) {
+    std::shared_ptr<Client> client = std::make_shared<Client>(fd, true);
+    std::string pending;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        pending.append(buf, n);
+        size_t pos;
+        while ((pos = pending.find('\n')) != std::string::npos) {
+            submit(pending.substr(0, pos), client, store, requests);
+            pending.erase(0, pos+1);
+        }
+    }
+    submit(pending, client, store, requests);
+}
+
+int serve_socket(const char *path, ModelStore &store, jobs::TaskGroup &requests) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (listener<0 || strlen(path) >= sizeof(addr.sun_path)) {
+        std::cerr << "bad socket path " << path << std::endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) || listen(listener, 16)) {
+        std::cerr << "can't listen on " << path << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::cerr << "# listening on " << path << std::endl;
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd<0) {
+            if (errno==EINTR) continue;
+            break;
+        }
+        std::thread(serve_connection, fd, std::ref(store), std::ref(requests)).detach();
+    }
+    close(listener);
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+    const char *socket_path = NULL;
+    ModelStore store;
+    jobs::Options pool;
+    pool.threads = std::max(1u, std::thread::hardware_concurrency());    // 主线程只读请求，不参与渲染
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--socket") && i+1<argc) socket_path = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i+1<argc) pool.threads = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--pin-threads")) pool.pin = true;
+        else if (!strcmp(argv[i], "--texture-budget") && i+1<argc) TextureCache::instance().set_budget(size_t(atol(argv[++i]))<<20);
+        else if (!strcmp(argv[i], "--compress-textures")) store.options.compress_textures = true;
+        else if (!strcmp(argv[i], "--compact-vertices")) store.options.compact_vertices = true;
+        else if (!strcmp(argv[i], "--lod-cache") && i+1<argc) store.lod_cache = argv[++i];
+        else if (!strcmp(argv[i], "--max-size") && i+1<argc) {
+            int w, h;
+            if (sscanf(argv[++i], "%dx%d", &w, &h)!=2 || w<=0 || h<=0 || std::int64_t(w)*h > INT_MAX) {
+                std::cerr << "bad max size " << argv[i] << ", expected WxH with at most " << INT_MAX << " pixels" << std::endl;
+                return 1;
+            }
+            max_pixels = std::int64_t(w)*h;
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--socket path] [--threads n] [--pin-threads] [--texture-budget MB] [--compress-textures] [--compact-vertices] [--lod-cache dir] [--max-size WxH]" << std::endl;
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    jobs::init(pool);
+    jobs::TaskGroup requests;
+    if (socket_path) return serve_socket(socket_path, store, requests);
+
+    std::shared_ptr<Client> out = std::make_shared<Client>(STDOUT_FILENO, false);
+    std::string line;
+    while (std::getline(std::cin, line)) submit(line, out, store, requests);
+    requests.wait();                                        // 处理完剩余的请求后退出
+    return 0;
+}
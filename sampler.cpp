@@ -0,0 +1,92 @@
+#include <climits>
+#include "sampler.h"
+
+#if defined(TINYRENDERER_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLER_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// 标量路径：逐路计算地址，循环次数固定为 8，编译器可以完全展开
+void sample8_scalar(const TGAImage &tex, const float *u, const float *v, unsigned mask, std::uint32_t *texels) {
+    const int w = tex.width(), h = tex.height(), bpp = tex.bytespp();
+    const std::uint8_t *data = tex.buffer();
+    for (int i=0; i<8; i++) {
+        int x = u[i]*w, y = v[i]*h;
+        std::uint32_t c = 0;
+        if ((mask >> i & 1) && x>=0 && y>=0 && x<w && y<h) {
+            const std::uint8_t *p = data + (x + size_t(y)*w)*bpp;
+            for (int k=bpp; k--; ) c = c << 8 | p[k];
+        }
+        texels[i] = c;
+    }
+}
+
+#ifdef SAMPLER_AVX2
+
+// 只有这个函数用 AVX2 编译，其余代码不要求 CPU 支持
+__attribute__((target("avx2")))
+void sample8_avx2(const TGAImage &tex, const float *u, const float *v, unsigned mask, std::uint32_t *texels) {
+    const int w = tex.width(), h = tex.height(), bpp = tex.bytespp();
+    const long long nbytes = (long long)w*h*bpp;
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i x = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(u), _mm256_set1_ps(w)));
+    __m256i y = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(v), _mm256_set1_ps(h)));
+    __m256i valid = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), bit), bit);
+    valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(x, _mm256_set1_epi32(-1)));
+    valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(y, _mm256_set1_epi32(-1)));
+    valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(_mm256_set1_epi32(w), x));
+    valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(_mm256_set1_epi32(h), y));
+    __m256i offset = _mm256_mullo_epi32(_mm256_add_epi32(x, _mm256_mullo_epi32(y, _mm256_set1_epi32(w))), _mm256_set1_epi32(bpp));
+
+    // 每路读 4 个字节：最后一个纹素之后不足 4 字节的路留给标量
+    __m256i tail = _mm256_cmpgt_epi32(offset, _mm256_set1_epi32(int(nbytes - 4)));
+    __m256i gather = _mm256_andnot_si256(tail, valid);
+    __m256i t = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)tex.buffer(), offset, gather, 1);
+    t = _mm256_and_si256(t, _mm256_set1_epi32(bpp >= 4 ? -1 : (1 << 8*bpp) - 1));
+    _mm256_storeu_si256((__m256i *)texels, t);
+
+    unsigned rest = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(tail, valid)));
+    if (rest) {
+        std::uint32_t scalar[8];
+        sample8_scalar(tex, u, v, rest, scalar);
+        for (int i=0; i<8; i++)
+            if (rest >> i & 1) texels[i] = scalar[i];
+    }
+}
+
+// 静态初始化时 CPU 特性表可能还没建立，先显式初始化
+const bool has_avx2 = [] { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }();
+
+#else
+
+const bool has_avx2 = false;
+
+#endif
+
+}
+
+bool sampler_simd() {
+    return has_avx2;
+}
+
+void sample8(const TGAImage &tex, const float *u, const float *v, unsigned mask, std::uint32_t *texels) {
+    // 32 位偏移放不下的特大贴图走标量路径
+#ifdef SAMPLER_AVX2
+    if (has_avx2 && (long long)tex.width()*tex.height()*tex.bytespp() <= INT_MAX && tex.bytespp() <= 4)
+        return sample8_avx2(tex, u, v, mask, texels);
+#endif
+    sample8_scalar(tex, u, v, mask, texels);
+}
+
+void sample8(const BlockTexture &tex, const float *u, const float *v, unsigned mask, std::uint32_t *texels) {
+    for (int i=0; i<8; i++)
+        texels[i] = mask >> i & 1 ? pack_color(tex.get(u[i]*tex.width(), v[i]*tex.height())) : 0;
+}
+
+void modulate8(const std::uint32_t *colors, const float *intensity, std::uint32_t *out) {
+    std::uint16_t k[8];
+    for (int i=0; i<8; i++) k[i] = color_weight(intensity[i]);
+    color_scale_n(colors, k, out, 8);
+}
@@ -0,0 +1,30 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+#include <cstdint>
+#include "tgaimage.h"
+#include "blocktex.h"
+
+// 8 路批量纹理采样，供 IShader::fragment_batch 使用
+// 纹素按 TGAColor 的字节顺序打包为 32 位：b | g<<8 | r<<16 | a<<24，bytespp 之外的字节为 0，与 TGAImage::get 逐字节相同
+// 编译时打开 TINYRENDERER_SIMD 且 CPU 支持 AVX2 时用 gather 指令一次取 8 个纹素，否则逐路标量读取
+
+inline std::uint32_t pack_color(const TGAColor &c) {
+    return c.bgra[0] | (c.bgra[1] << 8) | (c.bgra[2] << 16) | (std::uint32_t(c.bgra[3]) << 24);
+}
+
+inline TGAColor unpack_color(std::uint32_t c) {
+    return {std::uint8_t(c), std::uint8_t(c >> 8), std::uint8_t(c >> 16), std::uint8_t(c >> 24), 4};
+}
+
+// 最近点采样，纹理坐标换算与 Model 的单个纹素采样相同；mask 第 i 位为 0 或纹理坐标越界的路输出 0
+void sample8(const TGAImage &tex, const float *u, const float *v, unsigned mask, std::uint32_t *texels);
+// 块压缩纹理的纹素不能直接寻址，逐路解码
+void sample8(const BlockTexture &tex, const float *u, const float *v, unsigned mask, std::uint32_t *texels);
+
+// 每路颜色的各字节乘以截断到 [0, 1] 的 intensity，定点运算（color.h），与 TGAColor::operator* 逐位相同
+void modulate8(const std::uint32_t *colors, const float *intensity, std::uint32_t *out);
+
+// 当前是否走 AVX2 路径
+bool sampler_simd();
+
+#endif //__SAMPLER_H__
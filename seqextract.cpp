@@ -0,0 +1,52 @@
+// 从帧序列容器（见 sequence.h）还原逐帧的 TGA
+//   tinyrenderer_seqextract [--frame n] file.tseq [prefix]
+// 写出 <prefix>_0000.tga、<prefix>_0001.tga ...，prefix 默认为去掉扩展名的 file；与 write_tga_file 单独写出的每帧逐字节相同
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "sequence.h"
+
+int main(int argc, char **argv) {
+    const char *filename = NULL;
+    std::string prefix;
+    int only = -1;                                              // 非负时只还原这一帧
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--frame") && i+1<argc) only = atoi(argv[++i]);
+        else if (argv[i][0]=='-') {
+            std::cerr << "unknown option " << argv[i] << std::endl;
+            return 2;
+        }
+        else if (!filename) filename = argv[i];
+        else prefix = argv[i];
+    }
+    if (!filename) {
+        std::cerr << "usage: tinyrenderer_seqextract [--frame n] file.tseq [prefix]" << std::endl;
+        return 2;
+    }
+    if (prefix.empty()) {
+        std::string name(filename);
+        prefix = name.substr(0, name.find_last_of("."));
+    }
+
+    SequenceReader seq;
+    if (!seq.open(filename)) return 1;
+    if (only >= seq.frames()) {
+        std::cerr << filename << " has only " << seq.frames() << " frames" << std::endl;
+        return 1;
+    }
+    const int begin = only < 0 ? 0 : only, end = only < 0 ? seq.frames() : only + 1;
+    TGAImage frame;
+    for (int i=begin; i<end; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "_%04d.tga", i);
+        if (!seq.read(i, frame) || !frame.write_tga_file(prefix + name)) {
+            std::cerr << "can't extract frame " << i << std::endl;
+            return 1;
+        }
+    }
+    std::cerr << filename << ": " << end - begin << " of " << seq.frames() << " frames, "
+              << seq.width() << "x" << seq.height() << "/" << seq.bytespp()*8 << std::endl;
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include "sequence.h"
+#include "profiler.h"
+#include "jobs.h"
+
+#if defined(TINYRENDERER_SIMD) && defined(__SSE2__)
+#define SEQUENCE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const char MAGIC[4] = {'T','S','E','Q'};
+const int HEADER_SIZE = 10;
+const int INDEX_ENTRY = 9;
+const char KEYFRAME = 'K', DELTA = 'D';
+enum TileEncoding : std::uint8_t { TILE_DIFF = 0, TILE_RAW = 1 };
+
+void put(std::string &s, std::uint64_t v, int nbytes) {
+    for (int i=0; i<nbytes; i++) s.push_back(char(v >> 8*i & 255));
+}
+
+std::uint64_t get(const std::uint8_t *p, int nbytes) {
+    std::uint64_t v = 0;
+    for (int i=nbytes; i--; ) v = v << 8 | p[i];
+    return v;
+}
+
+bool get(std::istream &in, std::uint64_t &v, int nbytes) {
+    std::uint8_t buf[8];
+    in.read(reinterpret_cast<char *>(buf), nbytes);
+    v = get(buf, nbytes);
+    return in.good();
+}
+
+}
+
+bool tile_changed(const std::uint8_t *a, const std::uint8_t *b, size_t stride, size_t row_bytes, int rows) {
+    for (int r=0; r<rows; r++) {
+        const std::uint8_t *p = a + r*stride, *q = b + r*stride;
+        size_t i = 0;
+#ifdef SEQUENCE_SSE2
+        for (; i+16<=row_bytes; i+=16) {
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), _mm_loadu_si128((const __m128i *)(q + i)));
+            if (_mm_movemask_epi8(eq) != 0xFFFF) return true;
+        }
+#endif
+        if (std::memcmp(p + i, q + i, row_bytes - i)) return true;
+    }
+    return false;
+}
+
+bool SequenceWriter::open(const std::string &filename, int w_, int h_, int bpp_, int keyframe_interval_, int tile_) {
+    if (w_<=0 || h_<=0 || w_>TGA_MAX_SIZE || h_>TGA_MAX_SIZE || (bpp_!=TGAImage::GRAYSCALE && bpp_!=TGAImage::RGB && bpp_!=TGAImage::RGBA)
+        || tile_<=0 || tile_>255) {
+        std::cerr << "bad sequence format " << w_ << "x" << h_ << "/" << bpp_*8 << ", tile " << tile_ << "\n";
+        return false;
+    }
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    w = w_;
+    h = h_;
+    bpp = bpp_;
+    tile = tile_;
+    keyframe_interval = std::max(1, keyframe_interval_);
+    nkeys = 0;
+    prev = TGAImage();
+    index.clear();
+    std::string header(MAGIC, 4);
+    put(header, w, 2);
+    put(header, h, 2);
+    put(header, bpp, 1);
+    put(header, tile, 1);
+    out.write(header.data(), header.size());
+    offset = header.size();
+    return out.good();
+}
+
+bool SequenceWriter::write_frame(char type, const std::string &payload) {
+    std::string head(1, type);
+    put(head, payload.size(), 8);
+    out.write(head.data(), head.size());
+    out.write(payload.data(), payload.size());
+    index.push_back({offset, type});
+    offset += head.size() + payload.size();
+    if (type==KEYFRAME) nkeys++;
+    return out.good();
+}
+
+bool SequenceWriter::add_frame(const TGAImage &frame) {
+    PROFILE_SCOPE("sequence_encode");
+    if (!out.is_open() || frame.width()!=w || frame.height()!=h || frame.bytespp()!=bpp) {
+        std::cerr << "sequence frame doesn't match " << w << "x" << h << "/" << bpp*8 << "\n";
+        return false;
+    }
+    const int ntx = (w + tile - 1)/tile, nty = (h + tile - 1)/tile;
+    const size_t stride = size_t(w)*bpp;
+    bool key = index.empty() || index.size() % keyframe_interval == 0;
+
+    if (!key) {
+        // 每行块各自编码到内存，在线程池里并行，再按顺序拼接
+        std::vector<std::string> rows(nty);
+        std::vector<int> changed(nty, 0);
+        jobs::parallel_for(0, nty, 1, [&](int begin, int end) {
+            std::vector<std::uint8_t> diff(size_t(tile)*tile*bpp), raw(diff.size());
+            for (int ty=begin; ty<end; ty++) {
+                const int y0 = ty*tile, th = std::min(tile, h - y0);
+                for (int tx=0; tx<ntx; tx++) {
+                    const int x0 = tx*tile, tw = std::min(tile, w - x0);
+                    const size_t row_bytes = size_t(tw)*bpp, start = y0*stride + x0*bpp;
+                    const std::uint8_t *cur = frame.buffer() + start, *old = prev.buffer() + start;
+                    if (!tile_changed(cur, old, stride, row_bytes, th)) continue;
+                    for (int r=0; r<th; r++)
+                        for (size_t b=0; b<row_bytes; b++) {
+                            raw[r*row_bytes + b] = cur[r*stride + b];
+                            diff[r*row_bytes + b] = std::uint8_t(cur[r*stride + b] - old[r*stride + b]);
+                        }
+                    // 块内只有少数像素变化时差的 RLE 短，整块都变（如轮廓扫过）时原始像素的 RLE 短
+                    std::ostringstream enc[2];
+                    write_rle(enc[TILE_DIFF], diff.data(), size_t(tw)*th, bpp);
+                    write_rle(enc[TILE_RAW], raw.data(), size_t(tw)*th, bpp);
+                    TileEncoding best = enc[TILE_DIFF].tellp() <= enc[TILE_RAW].tellp() ? TILE_DIFF : TILE_RAW;
+                    put(rows[ty], ty*ntx + tx, 4);
+                    put(rows[ty], best, 1);
+                    rows[ty] += enc[best].str();
+                    changed[ty]++;
+                }
+            }
+        });
+        int nchanged = 0;
+        for (int c : changed) nchanged += c;
+        // 变化的块超过一半时差分几乎没有收益，改写关键帧，后面的差分帧也不必再重放这一段
+        if (2*nchanged > ntx*nty) {
+            key = true;
+        } else {
+            std::string payload;
+            put(payload, nchanged, 4);
+            for (const std::string &r : rows) payload += r;
+            if (!write_frame(DELTA, payload)) return false;
+        }
+    }
+    if (key) {
+        std::ostringstream buf;
+        if (!frame.write_tga(buf, false) || !write_frame(KEYFRAME, buf.str())) return false;
+    }
+    prev = frame;
+    return true;
+}
+
+bool SequenceWriter::close() {
+    if (!out.is_open()) return false;
+    std::string tail;
+    for (const auto &e : index) {
+        put(tail, e.first, 8);
+        put(tail, e.second, 1);
+    }
+    put(tail, index.size(), 4);
+    tail.append(MAGIC, 4);
+    out.write(tail.data(), tail.size());
+    bool ok = out.good();
+    out.close();
+    return ok;
+}
+
+bool SequenceReader::open(const std::string &filename) {
+    in.open(filename, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    std::uint8_t header[HEADER_SIZE], trailer[8];
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    in.seekg(-8, std::ios::end);
+    in.read(reinterpret_cast<char *>(trailer), sizeof(trailer));
+    if (!in.good() || std::memcmp(header, MAGIC, 4) || std::memcmp(trailer + 4, MAGIC, 4)) {
+        std::cerr << filename << " is not a frame sequence (or wasn't closed)\n";
+        return false;
+    }
+    w = get(header + 4, 2);
+    h = get(header + 6, 2);
+    bpp = header[8];
+    tile = header[9];
+    const std::uint64_t n = get(trailer, 4);
+    const std::uint64_t end = in.tellg();
+    if (w<=0 || h<=0 || tile<=0 || (bpp!=TGAImage::GRAYSCALE && bpp!=TGAImage::RGB && bpp!=TGAImage::RGBA)
+        || n*INDEX_ENTRY + 8 + HEADER_SIZE > end) {
+        std::cerr << "bad frame sequence header in " << filename << "\n";
+        return false;
+    }
+    const std::uint64_t index_begin = end - 8 - n*INDEX_ENTRY;
+    std::vector<std::uint8_t> entries(n*INDEX_ENTRY);
+    in.seekg(index_begin);
+    in.read(reinterpret_cast<char *>(entries.data()), entries.size());
+    index.resize(n);
+    for (size_t i=0; i<n; i++) {
+        index[i] = {get(&entries[i*INDEX_ENTRY], 8), char(entries[i*INDEX_ENTRY + 8])};
+        if (index[i].first < HEADER_SIZE || index[i].first >= index_begin || (index[i].second!=KEYFRAME && index[i].second!=DELTA)) {
+            std::cerr << "bad frame index in " << filename << "\n";
+            return false;
+        }
+    }
+    if (!in.good() || (n && index[0].second!=KEYFRAME)) {
+        std::cerr << "bad frame index in " << filename << "\n";
+        return false;
+    }
+    current_frame = -1;
+    return true;
+}
+
+bool SequenceReader::apply(int i) {
+    std::uint64_t size;
+    in.seekg(index[i].first + 1);
+    if (!get(in, size, 8)) return false;
+    std::string payload(size, '\0');
+    in.read(&payload[0], size);
+    if (!in.good()) return false;
+    std::istringstream s(payload);
+    if (index[i].second==KEYFRAME) {
+        if (!current.read_tga(s)) return false;
+        return current.width()==w && current.height()==h && current.bytespp()==bpp;
+    }
+    const int ntx = (w + tile - 1)/tile, nty = (h + tile - 1)/tile;
+    const size_t stride = size_t(w)*bpp;
+    std::vector<std::uint8_t> buf(size_t(tile)*tile*bpp);
+    std::uint64_t n;
+    if (!get(s, n, 4)) return false;
+    for (std::uint64_t k=0; k<n; k++) {
+        std::uint64_t t, mode;
+        if (!get(s, t, 4) || !get(s, mode, 1) || t >= std::uint64_t(ntx)*nty || mode > TILE_RAW) return false;
+        const int x0 = (t % ntx)*tile, y0 = (t / ntx)*tile;
+        const int tw = std::min(tile, w - x0), th = std::min(tile, h - y0);
+        const size_t row_bytes = size_t(tw)*bpp;
+        if (!read_rle(s, buf.data(), size_t(tw)*th, bpp)) return false;
+        std::uint8_t *dst = current.buffer() + y0*stride + x0*bpp;
+        for (int r=0; r<th; r++)
+            for (size_t b=0; b<row_bytes; b++)
+                dst[r*stride + b] = mode==TILE_DIFF ? std::uint8_t(dst[r*stride + b] + buf[r*row_bytes + b]) : buf[r*row_bytes + b];
+    }
+    return true;
+}
+
+bool SequenceReader::read(int i, TGAImage &frame) {
+    PROFILE_SCOPE("sequence_decode");
+    if (i<0 || i>=frames()) return false;
+    int start = i;
+    while (index[start].second!=KEYFRAME) start--;
+    // 当前帧在最近的关键帧和 i 之间时接着它重放
+    if (current_frame>=start && current_frame<=i) start = current_frame + 1;
+    for (int k=start; k<=i; k++) {
+        if (!apply(k)) {
+            std::cerr << "an error occured while decoding frame " << k << "\n";
+            current_frame = -1;
+            return false;
+        }
+        current_frame = k;
+    }
+    frame = current;
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "tgaimage.h"
+
+// 帧序列容器（.tseq），用于转台和动画：相邻帧的大部分像素不变，只存与上一帧相比变化的块，
+// 用 tinyrenderer_seqextract 还原出逐帧的 TGA
+//
+// 文件布局，整数均为小端：
+//   文件头  "TSEQ" u16 宽 u16 高 u8 bpp u8 块边长
+//   帧      u8 类型 u64 负载字节数 负载
+//           'K' 关键帧：负载是一个完整的 TGA（RLE，左上角为原点）
+//           'D' 差分帧：u32 变化块数，之后每块 u32 块号（行优先）u8 编码 + 块内像素按行连接后的 RLE（见 write_rle）
+//               编码 0 为与上一帧逐字节的差（模 256），块内没变的像素都是 0，成段的 0 压缩成一个数据包；编码 1 为原始像素
+//               两种都编码一遍，保留短的；右边和下边不足块边长的块按实际尺寸
+//   索引    每帧 u64 偏移 u8 类型，之后 u32 帧数 "TSEQ"；从文件尾找到索引即可随机访问
+// 每隔 keyframe_interval 帧，以及变化的块超过一半时，写一个关键帧，限制随机访问时需要重放的差分帧数
+
+class SequenceWriter {
+public:
+    bool open(const std::string &filename, int w, int h, int bpp, int keyframe_interval=30, int tile=16);
+    // 帧的尺寸和 bpp 须与 open 时相同；按从上到下的内存行序存储，与 write_tga(out, false) 相同
+    bool add_frame(const TGAImage &frame);
+    // 写入索引；没有 close 的文件不能读取
+    bool close();
+    int frames() const { return index.size(); }
+    int keyframes() const { return nkeys; }
+    std::uint64_t bytes() const { return offset; }
+private:
+    std::ofstream out;
+    int w = 0, h = 0, bpp = 0, tile = 16, keyframe_interval = 30, nkeys = 0;
+    TGAImage prev;                                      // 上一帧
+    std::vector<std::pair<std::uint64_t, char>> index;
+    std::uint64_t offset = 0;
+
+    bool write_frame(char type, const std::string &payload);
+};
+
+class SequenceReader {
+public:
+    bool open(const std::string &filename);
+    int frames() const { return index.size(); }
+    int width()  const { return w; }
+    int height() const { return h; }
+    int bytespp() const { return bpp; }
+    // 解码第 i 帧：从不晚于 i 的最近关键帧开始重放差分；顺序读取时每帧只重放一个差分
+    bool read(int i, TGAImage &frame);
+private:
+    std::ifstream in;
+    int w = 0, h = 0, bpp = 0, tile = 16;
+    std::vector<std::pair<std::uint64_t, char>> index;
+    TGAImage current;                                   // 最近解码的一帧
+    int current_frame = -1;
+
+    bool apply(int i);
+};
+
+// 两幅同样布局的图像中一块是否有字节不同：rows 行，每行 row_bytes 字节，相邻两行相距 stride 字节
+// 编译时打开 TINYRENDERER_SIMD 时用 SSE2 每次比较 16 个字节
+bool tile_changed(const std::uint8_t *a, const std::uint8_t *b, size_t stride, size_t row_bytes, int rows);
+
+#endif //__SEQUENCE_H__
@@ -0,0 +1,130 @@
+#ifndef __SHADERS_H__
+#define __SHADERS_H__
+#include "gl.h"
+#include "model.h"
+
+// 常用着色器；光源方向等参数作为成员保存，不读全局变量，可以在多个线程里各自实例化
+
+// 逐顶点漫反射光照，可选阴影贴图
+struct GouraudShader : public IShader {
+    Vec3f light_dir;                                    // 已归一化，模型/世界坐标
+    const ShadowMap *shadow = NULL;                     // 为 NULL 时不做阴影
+
+    GouraudShader(Vec3f light_dir, const ShadowMap *shadow = NULL) : light_dir(light_dir), shadow(shadow) {
+        nvaryings = shadow ? 4 : 1;                     // varying[0]: 光照强度；varying[1..3]: 世界坐标（阴影查询用）
+        batched = true;
+    }
+
+    virtual Vec4f vertex(Vec3f vert, Vec3f normal, int ivert) {
+        Vec4f n = uniform_N*Vec4f(normal.x, normal.y, normal.z, 0);
+        varying[ivert][0] = std::max(0.f, normalized(n.xyz())*light_dir);
+        if (shadow) {
+            Vec4f world = uniform_M*Vec4f(vert.x, vert.y, vert.z, 1);
+            for (int i=0; i<3; i++) varying[ivert][1+i] = world[i];
+        }
+        return uniform_MVP*Vec4f(vert.x, vert.y, vert.z, 1);
+    }
+
+    virtual bool fragment(Vec3f, Vec2f, TGAColor &color) {
+        float intensity = frag_varying[0];
+        if (shadow) intensity *= .3f + .7f*shadow->lit(Vec3f(frag_varying[1], frag_varying[2], frag_varying[3]));
+        color = TGAColor{255,255,255}*intensity;
+        return false;
+    }
+
+    virtual unsigned fragment_batch(FragmentBatch &batch) {
+        float intensity[FragmentBatch::SIZE];
+        light(batch, intensity);
+        std::uint32_t white[FragmentBatch::SIZE];
+        std::fill(white, white + FragmentBatch::SIZE, pack_color(TGAColor{255,255,255}));
+        modulate8(white, intensity, batch.color);
+        return 0;
+    }
+
+protected:
+    // 8 路的光照强度；阴影查询是对阴影贴图的随机访问，只对有效的路逐个做
+    void light(const FragmentBatch &batch, float *intensity) const {
+        for (int i=0; i<FragmentBatch::SIZE; i++) intensity[i] = batch.varying[0][i];
+        if (!shadow) return;
+        for (int i=0; i<FragmentBatch::SIZE; i++)
+            if (batch.mask >> i & 1)
+                intensity[i] *= .3f + .7f*shadow->lit(Vec3f(batch.varying[1][i], batch.varying[2][i], batch.varying[3][i]));
+    }
+};
+
+// 漫反射贴图乘逐顶点光照，有烘焙的环境光遮蔽贴图时再乘以遮蔽
+struct TextureShader : public GouraudShader {
+    Model *model;
+
+    TextureShader(Model *model, Vec3f light_dir, const ShadowMap *shadow = NULL) : GouraudShader(light_dir, shadow), model(model) {}
+
+    virtual bool fragment(Vec3f, Vec2f uvf, TGAColor &color) {
+        float intensity = frag_varying[0];
+        if (shadow) intensity *= .3f + .7f*shadow->lit(Vec3f(frag_varying[1], frag_varying[2], frag_varying[3]));
+        intensity *= model->ambient_occlusion(uvf);
+        color = model->diffuse(uvf)*intensity;
+        return false;
+    }
+
+    virtual unsigned fragment_batch(FragmentBatch &batch) {
+        float intensity[FragmentBatch::SIZE], ao[FragmentBatch::SIZE];
+        light(batch, intensity);
+        model->ambient_occlusion(batch.u, batch.v, batch.mask, ao);
+        for (int i=0; i<FragmentBatch::SIZE; i++) intensity[i] *= ao[i];
+        std::uint32_t texels[FragmentBatch::SIZE];
+        model->diffuse(batch.u, batch.v, batch.mask, texels);
+        modulate8(texels, intensity, batch.color);
+        return 0;
+    }
+};
+
+// 切线空间法线贴图：顶点阶段把 TBN 变换到世界空间作为 varying，片段阶段只做一次插值和一次 3x3 乘法
+// model 须为实际绘制的网格（LOD 各有自己的切线），并且以 ModelOptions::tangents 加载；没有切线或贴图时退化为逐顶点法线
+struct NormalMapShader : public IShader {
+    Model *model;
+    Vec3f light_dir;
+
+    NormalMapShader(Model *model, Vec3f light_dir) : model(model), light_dir(light_dir) {
+        nvaryings = 9;                                  // varying[0..3): T，[3..6): B，[6..9): N
+        batched = true;
+    }
+
+    virtual Vec4f vertex(Vec3f vert, Vec3f normal, int ivert) {
+        // 切线方向随模型矩阵变换，法线用法线矩阵
+        Vec3f t = model->tangent(iface, ivert), b = model->bitangent(iface, ivert);
+        Vec4f basis[3] = {uniform_M*Vec4f(t.x, t.y, t.z, 0), uniform_M*Vec4f(b.x, b.y, b.z, 0), uniform_N*Vec4f(normal.x, normal.y, normal.z, 0)};
+        for (int k=0; k<3; k++)
+            for (int i=0; i<3; i++) varying[ivert][k*3+i] = basis[k][i];
+        return uniform_MVP*Vec4f(vert.x, vert.y, vert.z, 1);
+    }
+
+    virtual bool fragment(Vec3f, Vec2f uvf, TGAColor &color) {
+        const float *f = frag_varying;
+        Vec3f t(f[0], f[1], f[2]), b(f[3], f[4], f[5]), n(f[6], f[7], f[8]);
+        Vec3f tn = model->tangent_normal(uvf);
+        if (tn*tn > 0) n = t*tn.x + b*tn.y + n*tn.z;
+        float intensity = std::max(0.f, normalized(n)*light_dir)*model->ambient_occlusion(uvf);
+        color = model->diffuse(uvf)*intensity;
+        return false;
+    }
+
+    virtual unsigned fragment_batch(FragmentBatch &batch) {
+        const int N = FragmentBatch::SIZE;
+        float tn[3][N], intensity[N], ao[N];
+        model->tangent_normal(batch.u, batch.v, batch.mask, tn);
+        model->ambient_occlusion(batch.u, batch.v, batch.mask, ao);
+        const auto &f = batch.varying;
+        for (int i=0; i<N; i++) {
+            Vec3f t(f[0][i], f[1][i], f[2][i]), b(f[3][i], f[4][i], f[5][i]), n(f[6][i], f[7][i], f[8][i]);
+            Vec3f m(tn[0][i], tn[1][i], tn[2][i]);
+            if (m*m > 0) n = t*m.x + b*m.y + n*m.z;
+            intensity[i] = std::max(0.f, normalized(n)*light_dir)*ao[i];
+        }
+        std::uint32_t texels[N];
+        model->diffuse(batch.u, batch.v, batch.mask, texels);
+        modulate8(texels, intensity, batch.color);
+        return 0;
+    }
+};
+
+#endif //__SHADERS_H__
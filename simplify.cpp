@@ -0,0 +1,234 @@
+#include <queue>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "simplify.h"
+
+namespace {
+
+// 对称 4x4 矩阵的上三角：a2 ab ac ad b2 bc bd c2 cd d2
+struct Quadric {
+    double m[10] = {0};
+
+    Quadric() = default;
+    Quadric(double a, double b, double c, double d, double weight)
+        : m{a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d} {
+        for (int i=0; i<10; i++) m[i] *= weight;
+    }
+
+    Quadric& operator+=(const Quadric &q) {
+        for (int i=0; i<10; i++) m[i] += q.m[i];
+        return *this;
+    }
+
+    double error(const Vec3f &v) const {
+        double x = v.x, y = v.y, z = v.z;
+        return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x
+             + m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y
+             + m[7]*z*z + 2*m[8]*z
+             + m[9];
+    }
+};
+
+struct Collapse {
+    double cost;
+    int a, b;
+    int va, vb;         // 入堆时两个端点的版本号，不一致说明已过期
+    Vec3f target;
+    bool operator<(const Collapse &o) const { return cost > o.cost; }   // 小顶堆
+};
+
+const double SEAM_WEIGHT = 1000.;
+
+std::uint64_t edge_key(int a, int b) {
+    if (a > b) std::swap(a, b);
+    return (std::uint64_t(a) << 32) | std::uint32_t(b);
+}
+
+struct EdgeInfo {
+    int count = 0;
+    int uva = -1, uvb = -1;     // 较小/较大顶点一侧的 uv 下标
+    bool seam = false;
+    int face = -1;
+};
+
+struct Simplifier {
+    std::vector<Vec3f> &verts;
+    std::vector<std::vector<Vec3i> > tris;          // 三个角点
+    std::vector<bool> dead_face;
+    std::vector<bool> dead_vert;
+    std::vector<int> version;
+    std::vector<Quadric> Q;
+    std::vector<std::vector<int> > adj;             // 顶点 -> 相邻面（可能含已删除的面）
+    std::priority_queue<Collapse> heap;
+    int live_faces = 0;
+
+    Simplifier(std::vector<Vec3f> &verts, const std::vector<std::vector<Vec3i> > &faces) : verts(verts) {
+        for (const std::vector<Vec3i> &f : faces)   // n 边形按扇形拆成三角形
+            for (int i=2; i<(int)f.size(); i++)
+                tris.push_back({f[0], f[i-1], f[i]});
+        live_faces = tris.size();
+        dead_face.assign(tris.size(), false);
+        dead_vert.assign(verts.size(), false);
+        version.assign(verts.size(), 0);
+        Q.assign(verts.size(), Quadric());
+        adj.assign(verts.size(), {});
+    }
+
+    Vec3f face_normal(int f, int moved=-1, Vec3f target={}) const {
+        Vec3f p[3];
+        for (int i=0; i<3; i++) {
+            int v = tris[f][i][0];
+            p[i] = v==moved ? target : verts[v];
+        }
+        return cross(p[1]-p[0], p[2]-p[0]);
+    }
+
+    void init_quadrics() {
+        std::unordered_map<std::uint64_t, EdgeInfo> edges;
+        for (int f=0; f<(int)tris.size(); f++) {
+            Vec3f n = face_normal(f);
+            double area = norm(n);
+            if (area <= 0) continue;
+            n = n/area;
+            Vec3f p0 = verts[tris[f][0][0]];
+            Quadric q(n.x, n.y, n.z, -(n*p0), area*.5);
+            for (int i=0; i<3; i++) {
+                int v = tris[f][i][0];
+                Q[v] += q;
+                adj[v].push_back(f);
+
+                const Vec3i &c0 = tris[f][i], &c1 = tris[f][(i+1)%3];
+                EdgeInfo &e = edges[edge_key(c0[0], c1[0])];
+                int uva = c0[0] < c1[0] ? c0[1] : c1[1];
+                int uvb = c0[0] < c1[0] ? c1[1] : c0[1];
+                if (e.count++ == 0) {
+                    e.uva = uva; e.uvb = uvb; e.face = f;
+                } else if (e.uva != uva || e.uvb != uvb) {
+                    e.seam = true;
+                }
+            }
+        }
+        // 开放边界和 UV 接缝：加一个过该边、垂直于面的约束平面
+        for (const auto &kv : edges) {
+            const EdgeInfo &e = kv.second;
+            if (e.count != 1 && !e.seam) continue;
+            int a = kv.first >> 32, b = kv.first & 0xffffffff;
+            Vec3f n = face_normal(e.face);
+            Vec3f dir = verts[b] - verts[a];
+            Vec3f m = cross(dir, n);
+            double len = norm(m);
+            if (len <= 0) continue;
+            m = m/len;
+            Quadric q(m.x, m.y, m.z, -(m*verts[a]), SEAM_WEIGHT*(dir*dir));
+            Q[a] += q;
+            Q[b] += q;
+        }
+        for (const auto &kv : edges) push(kv.first >> 32, kv.first & 0xffffffff);
+    }
+
+    void push(int a, int b) {
+        Quadric q = Q[a];
+        q += Q[b];
+        Vec3f candidates[3] = {verts[a], verts[b], (verts[a]+verts[b])*.5f};
+        Collapse c = {q.error(candidates[0]), a, b, version[a], version[b], candidates[0]};
+        for (int i=1; i<3; i++) {
+            double cost = q.error(candidates[i]);
+            if (cost < c.cost) { c.cost = cost; c.target = candidates[i]; }
+        }
+        heap.push(c);
+    }
+
+    // 折叠后任何相邻面法线翻转（或退化）都拒绝
+    bool valid(int a, int b, Vec3f target) const {
+        for (int v : {a, b}) {
+            for (int f : adj[v]) {
+                if (dead_face[f]) continue;
+                bool has_a = false, has_b = false;
+                for (int i=0; i<3; i++) {
+                    has_a |= tris[f][i][0]==a;
+                    has_b |= tris[f][i][0]==b;
+                }
+                if (has_a && has_b) continue;           // 会被删除的面
+                Vec3f n0 = face_normal(f);
+                Vec3f n1 = face_normal(f, v, target);
+                double l0 = norm(n0), l1 = norm(n1);
+                if (l1 <= 1e-12 || (n0*n1) < .2*l0*l1) return false;
+            }
+        }
+        return true;
+    }
+
+    void collapse(int a, int b, Vec3f target) {
+        verts[a] = target;
+        Q[a] += Q[b];
+        for (int f : adj[b]) {
+            if (dead_face[f]) continue;
+            bool has_a = false;
+            for (int i=0; i<3; i++) has_a |= tris[f][i][0]==a;
+            if (has_a) {
+                dead_face[f] = true;
+                live_faces--;
+                continue;
+            }
+            for (int i=0; i<3; i++) if (tris[f][i][0]==b) tris[f][i][0] = a;
+            adj[a].push_back(f);
+        }
+        adj[b].clear();
+        dead_vert[b] = true;
+        version[a]++;
+        version[b]++;
+
+        // 清理 a 的邻接表，并重新计算 a 周围所有边的代价
+        std::vector<int> live, neighbors;
+        for (int f : adj[a]) {
+            if (dead_face[f] || std::find(live.begin(), live.end(), f)!=live.end()) continue;
+            live.push_back(f);
+            for (int i=0; i<3; i++) {
+                int n = tris[f][i][0];
+                if (n!=a && std::find(neighbors.begin(), neighbors.end(), n)==neighbors.end()) neighbors.push_back(n);
+            }
+        }
+        adj[a] = live;
+        for (int n : neighbors) push(a, n);
+    }
+
+    void run(int target_faces) {
+        init_quadrics();
+        while (live_faces > target_faces && !heap.empty()) {
+            Collapse c = heap.top();
+            heap.pop();
+            if (dead_vert[c.a] || dead_vert[c.b] || version[c.a]!=c.va || version[c.b]!=c.vb) continue;
+            if (!valid(c.a, c.b, c.target)) continue;
+            collapse(c.a, c.b, c.target);
+        }
+    }
+};
+
+}
+
+void simplify_mesh(std::vector<Vec3f> &verts, std::vector<std::vector<Vec3i> > &faces, int target_faces) {
+    Simplifier s(verts, faces);
+    s.run(target_faces);
+
+    // 压缩顶点数组，去掉已折叠和不再被引用的顶点
+    std::vector<int> remap(verts.size(), -1);
+    std::vector<Vec3f> out_verts;
+    faces.clear();
+    for (int f=0; f<(int)s.tris.size(); f++) {
+        if (s.dead_face[f]) continue;
+        std::vector<Vec3i> face;
+        for (int i=0; i<3; i++) {
+            Vec3i c = s.tris[f][i];
+            if (remap[c[0]] < 0) {
+                remap[c[0]] = out_verts.size();
+                out_verts.push_back(verts[c[0]]);
+            }
+            c[0] = remap[c[0]];
+            face.push_back(c);
+        }
+        faces.push_back(face);
+    }
+    verts = out_verts;
+}
@@ -0,0 +1,11 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+#include <vector>
+#include "geometrylix.h"
+
+// 二次误差度量 (Garland-Heckbert QEM) 的边折叠网格简化
+// faces 的每个角点为 vertex/uv/normal 下标；折叠只移动位置，角点保留各自的 uv/normal 下标，
+// UV 接缝和开放边界加了约束平面，尽量不被折叠破坏。结果中的面均为三角形，未被引用的顶点会被移除
+void simplify_mesh(std::vector<Vec3f> &verts, std::vector<std::vector<Vec3i> > &faces, int target_faces);
+
+#endif //__SIMPLIFY_H__
@@ -0,0 +1,164 @@
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <csignal>
+#include <iostream>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "sortlast.h"
+#include "jobs.h"
+
+namespace {
+
+// 工作进程 -> 协调进程：ARRIVE 到达屏障，DONE/FAIL 为 fn 的结果；协调进程 -> 工作进程：GO 放行屏障
+enum Message : char { ARRIVE = 'a', DONE = 'd', FAIL = 'f', GO = 'g' };
+
+// MSG_NOSIGNAL：对端进程已经退出时返回错误而不是收到 SIGPIPE
+bool send_message(int fd, char c) {
+    ssize_t r;
+    do r = send(fd, &c, 1, MSG_NOSIGNAL); while (r < 0 && errno==EINTR);
+    return r==1;
+}
+
+bool recv_message(int fd, char &c) {
+    ssize_t r;
+    do r = read(fd, &c, 1); while (r < 0 && errno==EINTR);
+    return r==1;
+}
+
+}
+
+bool SortLastWorker::barrier() {
+    char c;
+    return send_message(fd_, ARRIVE) && recv_message(fd_, c) && c==GO;
+}
+
+bool SortLastWorker::composite(TGAImage *image, float *zbuffer, int width, int height) {
+    const size_t npixels = size_t(width)*height;
+    const int bpp = bpp_;
+    if (npixels > max_pixels_ || (image && (image->bytespp() != bpp || size_t(image->width())*image->height() != npixels))) {
+        std::cerr << "sort-last: worker " << index_ << " composite size mismatch" << std::endl;
+        return false;
+    }
+    std::memcpy(depth(index_), zbuffer, npixels*sizeof(float));
+    if (image) std::memcpy(color(index_), image->buffer(), npixels*bpp);
+    if (!barrier()) return false;
+
+    // 本进程负责的一条：逐像素在所有进程的深度里取最大（最近）的一个
+    std::vector<const float *> depths(count_);
+    for (int j=0; j<count_; j++) depths[j] = depth(j);
+    float *zres = depth(count_);
+    std::uint8_t *cres = color(count_);
+    size_t begin = size_t(height*index_/count_)*width, end = size_t(height*(index_+1)/count_)*width;
+    for (size_t p=begin; p<end; p++) {
+        int best = 0;
+        float z = depths[0][p];
+        for (int j=1; j<count_; j++)
+            if (depths[j][p] >= z) {
+                z = depths[j][p];
+                best = j;
+            }
+        zres[p] = z;
+        if (image) std::memcpy(cres + p*bpp, color(best) + p*bpp, bpp);
+    }
+    // 第二次同步后所有条都已合成；下一次 composite 写自己的槽位时别的进程已不再读它，不需要第三次同步
+    if (!barrier()) return false;
+    std::memcpy(zbuffer, zres, npixels*sizeof(float));
+    if (image) std::memcpy(image->buffer(), cres, npixels*bpp);
+    return true;
+}
+
+bool run_sort_last(int nworkers, int width, int height, int bpp, TGAImage &out, const std::function<bool(SortLastWorker &)> &fn) {
+    if (jobs::running()) {
+        std::cerr << "sort-last: must be started before the thread pool" << std::endl;
+        return false;
+    }
+    nworkers = std::max(1, nworkers);
+    const size_t npixels = size_t(width)*height;
+    const size_t slot_bytes = (npixels*(sizeof(float) + bpp) + 63) & ~size_t(63);
+    const size_t bytes = slot_bytes*(nworkers + 1);
+    // 匿名共享映射在 fork 之后父子进程都能访问，页面在第一次写入时才分配
+    void *shared = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared==MAP_FAILED) {
+        std::cerr << "sort-last: can't map " << bytes << " bytes of shared memory: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    for (int i=0; ok && i<nworkers; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+            std::cerr << "sort-last: socketpair failed: " << std::strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid==0) {
+            close(sv[0]);
+            for (int fd : fds) close(fd);
+            SortLastWorker worker(i, nworkers, sv[1], static_cast<std::uint8_t *>(shared), slot_bytes, npixels, bpp);
+            bool result = false;
+            try {
+                result = fn(worker);
+            } catch (const std::exception &e) {
+                std::cerr << "sort-last: worker " << i << ": " << e.what() << std::endl;
+            }
+            send_message(sv[1], result ? DONE : FAIL);
+            std::cout.flush();
+            std::cerr.flush();
+            _exit(result ? 0 : 1);                  // 不执行从协调进程继承来的静态析构和 atexit
+        }
+        close(sv[1]);
+        if (pid < 0) {
+            std::cerr << "sort-last: fork failed: " << std::strerror(errno) << std::endl;
+            close(sv[0]);
+            ok = false;
+            break;
+        }
+        pids.push_back(pid);
+        fds.push_back(sv[0]);
+    }
+
+    // 转发屏障：每一轮收齐所有工作进程的消息，全部到达屏障时放行，全部完成时结束
+    while (ok) {
+        size_t arrived = 0, done = 0;
+        for (int fd : fds) {
+            char c;
+            if (!recv_message(fd, c) || c==FAIL) {
+                ok = false;
+                break;
+            }
+            (c==ARRIVE ? arrived : done)++;
+        }
+        if (!ok || done==fds.size()) break;
+        if (arrived != fds.size()) {
+            std::cerr << "sort-last: workers made different numbers of composite calls" << std::endl;
+            ok = false;
+            break;
+        }
+        for (int fd : fds) send_message(fd, GO);
+    }
+
+    if (!ok)
+        for (pid_t pid : pids) kill(pid, SIGKILL);
+    for (pid_t pid : pids) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno==EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) ok = false;
+    }
+    for (int fd : fds) close(fd);
+
+    if (ok) {
+        out = TGAImage(width, height, bpp);
+        std::memcpy(out.buffer(), static_cast<std::uint8_t *>(shared) + nworkers*slot_bytes + npixels*sizeof(float), npixels*bpp);
+    }
+    munmap(shared, bytes);
+    return ok;
+}
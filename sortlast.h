@@ -0,0 +1,48 @@
+#ifndef __SORTLAST_H__
+#define __SORTLAST_H__
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "tgaimage.h"
+
+// sort-last 分布式渲染：模型的面等分给 N 个工作进程（见 ModelOptions::part），每个进程用普通流水线画出整幅的颜色和深度，
+// 之后逐像素按深度合成。本机的子进程代替集群节点：帧缓冲的交换走共享内存，同步走 Unix 域套接字，
+// 除此之外进程之间不共享任何状态，每个进程只持有自己那一份几何，几何吞吐量和可容纳的网格大小随进程数增长
+//
+// 合成用 direct-send：图像按行等分成 N 条，工作进程 i 从所有进程的缓冲中读出第 i 条，逐像素取最近的深度写入结果，
+// 合成的计算量由 N 个进程平摊
+
+class SortLastWorker {
+public:
+    int index() const { return index_; }
+    int count() const { return count_; }
+
+    // 集体操作，所有工作进程须以相同的尺寸依次调用：按深度合成各自的 zbuffer（和 image，可以为 NULL），结果写回每个进程的缓冲
+    // 深度相等时编号大的进程胜出，与单进程按面序绘制、后画的面覆盖先画的面一致
+    // 像素数不能超过 run_sort_last 的 width x height，image 的 bytespp 须与其 bpp 相同；失败时返回 false
+    bool composite(TGAImage *image, float *zbuffer, int width, int height);
+
+private:
+    friend bool run_sort_last(int, int, int, int, TGAImage &, const std::function<bool(SortLastWorker &)> &);
+    SortLastWorker(int index, int count, int fd, std::uint8_t *shared, size_t slot_bytes, size_t max_pixels, int bpp)
+        : index_(index), count_(count), fd_(fd), shared_(shared), slot_bytes_(slot_bytes), max_pixels_(max_pixels), bpp_(bpp) {}
+
+    int index_, count_;
+    int fd_;                            // 与协调进程之间的套接字
+    std::uint8_t *shared_;              // count_ + 1 个槽位：每个工作进程一个，最后一个存放合成结果
+    size_t slot_bytes_, max_pixels_;
+    int bpp_;
+
+    // 槽位内先放深度再放颜色，深度按 4 字节对齐
+    float *depth(int slot) const { return reinterpret_cast<float *>(shared_ + slot*slot_bytes_); }
+    std::uint8_t *color(int slot) const { return shared_ + slot*slot_bytes_ + max_pixels_*sizeof(float); }
+    // 所有工作进程都到达后才返回，经协调进程转发
+    bool barrier();
+};
+
+// 启动 nworkers 个工作进程各自执行 fn，fn 返回 false 或进程异常退出都算失败，此时其余进程被终止
+// 全部成功时 out 为最后一次带颜色的合成结果（width x height，bpp 字节每像素）
+// 须在线程池（jobs.h）启动之前调用：fork 只复制调用线程，子进程里的线程池需要重新创建
+bool run_sort_last(int nworkers, int width, int height, int bpp, TGAImage &out, const std::function<bool(SortLastWorker &)> &fn);
+
+#endif //__SORTLAST_H__
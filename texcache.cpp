@@ -0,0 +1,144 @@
+#include <iostream>
+#include "texcache.h"
+#include "profiler.h"
+
+TextureCache &TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+Texture TextureCache::load(const std::string &path) {
+    return std::static_pointer_cast<const TGAImage>(load(path, path, [&](size_t &bytes) -> std::shared_ptr<const void> {
+        PROFILE_SCOPE("texture_decode");
+        std::shared_ptr<TGAImage> img = std::make_shared<TGAImage>();
+        if (!img->read_tga_file(path)) return NULL;
+        img->flip_vertically();
+        bytes = size_t(img->width())*img->height()*img->bytespp();
+        return img;
+    }));
+}
+
+CompressedTexture TextureCache::load_compressed(const std::string &path, BlockFormat format) {
+    static const char *names[] = {"#bc1", "#bc4", "#bc5"};
+    return std::static_pointer_cast<const BlockTexture>(load(path + names[int(format)], path, [&](size_t &bytes) -> std::shared_ptr<const void> {
+        std::shared_ptr<BlockTexture> tex = std::make_shared<BlockTexture>();
+        if (!load_block_texture(path, format, *tex)) return NULL;
+        bytes = tex->bytes();
+        return tex;
+    }));
+}
+
+std::shared_ptr<const void> TextureCache::load(const std::string &key, const std::string &path, const std::function<std::shared_ptr<const void>(size_t &bytes)> &decode) {
+    std::error_code ec;
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, ec);
+    if (ec) return NULL;
+
+    // 已有同一版本（加载完成或正在加载）时等待它；否则插入一个未就绪的条目，由本线程解码，其他线程等它
+    std::promise<std::shared_ptr<const void> > promise;
+    std::uint64_t id = 0;
+    Future pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end() && it->second.mtime == mtime) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            pending = it->second.tex;
+        } else if (it != entries_.end()) {                   // 文件已更新，替换旧版本
+            retire(it->second);
+            lru_.erase(it->second.lru);
+            entries_.erase(it);
+        }
+        if (!pending.valid()) {
+            id = next_id_++;
+            lru_.push_front(key);
+            entries_[key] = {promise.get_future().share(), mtime, 0, false, id, lru_.begin()};
+        }
+    }
+    if (pending.valid()) return jobs::wait(pending);        // 等待期间执行线程池里的任务
+
+    // 解码不持锁，不同贴图可以并行加载
+    size_t bytes = 0;
+    std::shared_ptr<const void> tex = decode(bytes);
+    promise.set_value(tex);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end() || it->second.id != id) {
+        // 解码期间条目被 clear 或更新的版本替换：结果只交给调用者和已经在等的请求，和被替换的旧版本一样计数到释放为止
+        if (tex) {
+            resident_ += bytes;
+            retired_.push_back({tex, bytes});
+        }
+        return tex;
+    }
+    if (!tex) {                                              // 失败的加载不缓存，文件修好后可以重试
+        lru_.erase(it->second.lru);
+        entries_.erase(it);
+        return NULL;
+    }
+    it->second.bytes = bytes;
+    it->second.ready = true;
+    resident_ += bytes;
+    evict();
+    return tex;
+}
+
+// 从 entries_ 移走之前调用：只有缓存自己持有时直接释放，否则转入 retired_ 继续计数
+void TextureCache::retire(Entry &e) {
+    if (!e.ready) return;
+    std::weak_ptr<const void> weak = e.tex.get();
+    e.tex = Future();
+    if (weak.expired()) resident_ -= e.bytes;
+    else retired_.push_back({weak, e.bytes});
+}
+
+void TextureCache::collect_retired() {
+    for (size_t i=0; i<retired_.size(); ) {
+        if (!retired_[i].tex.expired()) {
+            i++;
+            continue;
+        }
+        resident_ -= retired_[i].bytes;
+        retired_[i] = retired_.back();
+        retired_.pop_back();
+    }
+}
+
+void TextureCache::evict() {
+    collect_retired();
+    for (auto it = lru_.end(); resident_ > budget_ && it != lru_.begin(); ) {
+        --it;
+        Entry &e = entries_[*it];
+        if (!e.ready || e.tex.get().use_count() > 1) continue;  // 正在加载，或者除了缓存之外仍有 Model 持有
+        resident_ -= e.bytes;
+        entries_.erase(*it);
+        it = lru_.erase(it);
+    }
+    if (resident_ > budget_)
+        std::cerr << "texture cache over budget: " << resident_ << " > " << budget_ << " bytes in use\n";
+}
+
+void TextureCache::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict();
+}
+
+size_t TextureCache::budget() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+size_t TextureCache::resident() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collect_retired();
+    return resident_;
+}
+
+// 还有持有者的纹理仍然计入 resident，释放后由 collect_retired 扣除
+void TextureCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &[key, e] : entries_) retire(e);
+    entries_.clear();
+    lru_.clear();
+}
@@ -0,0 +1,104 @@
+#ifndef __TEXCACHE_H__
+#define __TEXCACHE_H__
+#include <list>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <filesystem>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include "tgaimage.h"
+#include "blocktex.h"
+#include "jobs.h"
+
+// 引用计数的只读纹理句柄，最后一个持有者释放时纹理内存才会回收
+typedef std::shared_ptr<const TGAImage> Texture;
+typedef std::shared_ptr<const BlockTexture> CompressedTexture;
+
+// 进程内共享的纹理缓存：按路径和修改时间去重，多个 Model 引用同一张贴图时只保留一份；
+// 同一文件的并发首次请求只解码一次，后到的等待同一次加载
+// 超过内存预算时按 LRU 淘汰只被缓存自己持有的纹理；仍被 Model 引用的纹理不会被淘汰，
+// 文件更新后被替换的旧版本也照样计入 resident，直到最后一个持有者释放
+class TextureCache {
+public:
+    static TextureCache &instance();
+
+    // 读取并按纹理坐标朝向翻转；文件不存在或解码失败时返回空句柄
+    Texture load(const std::string &path);
+    // 块压缩版本，与未压缩版本分别缓存；压缩结果同时缓存在磁盘上，见 load_block_texture
+    CompressedTexture load_compressed(const std::string &path, BlockFormat format);
+    void set_budget(size_t bytes);
+    size_t budget();
+    size_t resident();
+    void clear();
+
+private:
+    typedef std::shared_future<std::shared_ptr<const void> > Future;
+
+    struct Entry {
+        Future tex;                             // Texture 或 CompressedTexture，解码完成前为未就绪的 future
+        std::filesystem::file_time_type mtime;
+        size_t bytes;                           // 解码完成后才计入 resident
+        bool ready;
+        std::uint64_t id;                       // 区分同一个 key 先后插入的条目
+        std::list<std::string>::iterator lru;
+    };
+
+    // 被新版本替换、但还有 Model 持有的旧纹理
+    struct Retired {
+        std::weak_ptr<const void> tex;
+        size_t bytes;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> lru_;                // 队首为最近使用
+    std::vector<Retired> retired_;
+    size_t budget_ = size_t(1) << 30;
+    size_t resident_ = 0;
+    std::uint64_t next_id_ = 0;
+
+    void evict();
+    void retire(Entry &e);
+    void collect_retired();
+    // key 区分同一文件的不同存储格式；decode 不持锁调用，失败时返回空指针
+    std::shared_ptr<const void> load(const std::string &key, const std::string &path, const std::function<std::shared_ptr<const void>(size_t &bytes)> &decode);
+};
+
+// 延迟/异步加载的纹理：持有一个（可能尚未完成的）加载结果，第一次访问时等待并缓存指针，之后访问只有一次原子读
+template<typename T> class Lazy {
+public:
+    Lazy() = default;
+    Lazy(const Lazy &) = delete;
+    Lazy& operator=(const Lazy &) = delete;
+
+    void reset(std::shared_future<std::shared_ptr<const T> > future) {
+        future_ = future;
+        img_.store(NULL, std::memory_order_relaxed);
+        ready_.store(false, std::memory_order_release);
+    }
+
+    // 纹理缺失时返回 NULL
+    const T *get() {
+        if (ready_.load(std::memory_order_acquire)) return img_.load(std::memory_order_relaxed);
+        if (!future_.valid()) return NULL;
+        const T *img = jobs::wait(future_).get();       // 等待期间执行线程池里的任务，不占着线程空等；可以被多个线程同时调用
+        img_.store(img, std::memory_order_relaxed);
+        ready_.store(true, std::memory_order_release);
+        return img;
+    }
+
+private:
+    std::shared_future<std::shared_ptr<const T> > future_;
+    std::atomic<const T*> img_ = NULL;
+    std::atomic<bool> ready_ = false;
+};
+
+typedef Lazy<TGAImage> LazyTexture;
+typedef Lazy<BlockTexture> LazyCompressedTexture;
+
+#endif //__TEXCACHE_H__
@@ -1,16 +1,119 @@
 #include <iostream>
 #include <cstring>
+#include <sstream>
+#include <algorithm>
 #include "tgaimage.h"
+#include "profiler.h"
+#include "jobs.h"
 
-TGAImage::TGAImage(const int w, const int h, const int bpp) : w(w), h(h), bpp(bpp), data(w*h*bpp, 0) {}
+namespace {
+
+bool write_footer(std::ostream &out) {
+    constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
+    constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
+    constexpr std::uint8_t footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+    out.write(reinterpret_cast<const char *>(developer_area_ref), sizeof(developer_area_ref));
+    out.write(reinterpret_cast<const char *>(extension_area_ref), sizeof(extension_area_ref));
+    out.write(reinterpret_cast<const char *>(footer), sizeof(footer));
+    return out.good();
+}
+
+}
+
+bool write_rle(std::ostream &out, const std::uint8_t *data, size_t npixels, int bpp) {
+    const std::uint8_t max_chunk_length = 128;
+    size_t curpix = 0;
+    while (curpix<npixels) {
+        size_t chunkstart = curpix*bpp;
+        size_t curbyte = curpix*bpp;
+        std::uint8_t run_length = 1;
+        bool raw = true;
+        while (curpix+run_length<npixels && run_length<max_chunk_length) {
+            bool succ_eq = true;
+            for (int t=0; succ_eq && t<bpp; t++)
+                succ_eq = (data[curbyte+t]==data[curbyte+t+bpp]);
+            curbyte += bpp;
+            if (1==run_length)
+                raw = !succ_eq;
+            if (raw && succ_eq) {
+                run_length--;
+                break;
+            }
+            if (!raw && !succ_eq)
+                break;
+            run_length++;
+        }
+        curpix += run_length;
+        out.put(raw ? run_length-1 : run_length+127);
+        if (!out.good()) return false;
+        out.write(reinterpret_cast<const char *>(data+chunkstart), (raw?run_length*bpp:bpp));
+        if (!out.good()) return false;
+    }
+    return true;
+}
+
+bool read_rle(std::istream &in, std::uint8_t *data, size_t npixels, int bpp) {
+    size_t currentpixel = 0;
+    size_t currentbyte  = 0;
+    std::uint8_t colorbuffer[4];
+    while (currentpixel < npixels) {
+        std::uint8_t chunkheader = in.get();
+        if (!in.good()) return false;
+        if (chunkheader<128) {
+            chunkheader++;
+            if (currentpixel+chunkheader > npixels) return false;
+            in.read(reinterpret_cast<char *>(data+currentbyte), size_t(chunkheader)*bpp);
+            if (!in.good()) return false;
+            currentbyte += size_t(chunkheader)*bpp;
+        } else {
+            chunkheader -= 127;
+            if (currentpixel+chunkheader > npixels) return false;
+            in.read(reinterpret_cast<char *>(colorbuffer), bpp);
+            if (!in.good()) return false;
+            for (int i=0; i<chunkheader; i++)
+                for (int t=0; t<bpp; t++)
+                    data[currentbyte++] = colorbuffer[t];
+        }
+        currentpixel += chunkheader;
+    }
+    return true;
+}
+
+namespace {
+
+// 逐行 RLE 编码（数据包不跨行）：每 64 行一段在线程池里并行编码到内存，再按顺序写出
+bool write_rle_rows(std::ostream &out, const std::uint8_t *p, int w, int nrows, size_t stride, int bpp) {
+    const int ROWS = 64;
+    std::vector<std::string> encoded((nrows + ROWS - 1)/ROWS);
+    jobs::parallel_for(0, encoded.size(), 1, [&](int begin, int end) {
+        for (int s=begin; s<end; s++) {
+            std::ostringstream buf;
+            for (int r=s*ROWS; r<std::min(nrows, (s+1)*ROWS); r++) write_rle(buf, p + r*stride, w, bpp);
+            encoded[s] = buf.str();
+        }
+    });
+    for (const std::string &e : encoded) out.write(e.data(), e.size());
+    return out.good();
+}
+
+}
+
+TGAImage::TGAImage(const int w, const int h, const int bpp) : w(w), h(h), bpp(bpp), data(size_t(w)*h*bpp, 0) {}
 
 bool TGAImage::read_tga_file(const std::string filename) {
+    PROFILE_SCOPE("tga_decode");
     std::ifstream in;
     in.open(filename, std::ios::binary);
     if (!in.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
+    if (!read_tga(in)) return false;
+    std::cerr << w << "x" << h << "/" << bpp*8 << "\n";
+    return true;
+}
+
+bool TGAImage::read_tga(std::istream &in) {
     TGAHeader header;
     in.read(reinterpret_cast<char *>(&header), sizeof(header));
     if (!in.good()) {
@@ -24,7 +127,7 @@ bool TGAImage::read_tga_file(const std::string filename) {
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    size_t nbytes = bpp*w*h;
+    size_t nbytes = size_t(bpp)*w*h;
     data = std::vector<std::uint8_t>(nbytes, 0);
     if (3==header.datatypecode || 2==header.datatypecode) {
         in.read(reinterpret_cast<char *>(data.data()), nbytes);
@@ -45,69 +148,34 @@ bool TGAImage::read_tga_file(const std::string filename) {
         flip_vertically();
     if (header.imagedescriptor & 0x10)
         flip_horizontally();
-    std::cerr << w << "x" << h << "/" << bpp*8 << "\n";
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-    size_t pixelcount = w*h;
-    size_t currentpixel = 0;
-    size_t currentbyte  = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
-        if (chunkheader<128) {
-            chunkheader++;
-            for (int i=0; i<chunkheader; i++) {
-                in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
-        } else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
-            }
-            for (int i=0; i<chunkheader; i++) {
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
-        }
-    } while (currentpixel < pixelcount);
+bool TGAImage::load_rle_data(std::istream &in) {
+    if (!read_rle(in, data.data(), size_t(w)*h, bpp)) {
+        std::cerr << "an error occured while reading the data\n";
+        return false;
+    }
     return true;
 }
 
 bool TGAImage::write_tga_file(const std::string filename, const bool vflip, const bool rle) const {
-    constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
-    constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
-    constexpr std::uint8_t footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+    PROFILE_SCOPE("tga_encode");
+    if (w>TGA_MAX_SIZE || h>TGA_MAX_SIZE) {
+        std::cerr << "image is too large for tga: " << w << "x" << h << "\n";
+        return false;
+    }
     std::ofstream out;
     out.open(filename, std::ios::binary);
     if (!out.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
+    return write_tga(out, vflip, rle);
+}
+
+bool TGAImage::write_tga(std::ostream &out, const bool vflip, const bool rle) const {
+    if (w>TGA_MAX_SIZE || h>TGA_MAX_SIZE) return false;
     TGAHeader header = {};
     header.bitsperpixel = bpp<<3;
     header.width  = w;
@@ -117,79 +185,46 @@ bool TGAImage::write_tga_file(const std::string filename, const bool vflip, cons
     out.write(reinterpret_cast<const char *>(&header), sizeof(header));
     if (!out.good()) goto err;
     if (!rle) {
-        out.write(reinterpret_cast<const char *>(data.data()), w*h*bpp);
+        out.write(reinterpret_cast<const char *>(data.data()), data.size());
         if (!out.good()) goto err;
     } else if (!unload_rle_data(out)) goto err;
-    out.write(reinterpret_cast<const char *>(developer_area_ref), sizeof(developer_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(extension_area_ref), sizeof(extension_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(footer), sizeof(footer));
-    if (!out.good()) goto err;
+    if (!write_footer(out)) goto err;
     return true;
 err:
     std::cerr << "can't dump the tga file\n";
     return false;
 }
 
-bool TGAImage::unload_rle_data(std::ofstream &out) const {
-    const std::uint8_t max_chunk_length = 128;
-    size_t npixels = w*h;
-    size_t curpix = 0;
-    while (curpix<npixels) {
-        size_t chunkstart = curpix*bpp;
-        size_t curbyte = curpix*bpp;
-        std::uint8_t run_length = 1;
-        bool raw = true;
-        while (curpix+run_length<npixels && run_length<max_chunk_length) {
-            bool succ_eq = true;
-            for (int t=0; succ_eq && t<bpp; t++)
-                succ_eq = (data[curbyte+t]==data[curbyte+t+bpp]);
-            curbyte += bpp;
-            if (1==run_length)
-                raw = !succ_eq;
-            if (raw && succ_eq) {
-                run_length--;
-                break;
-            }
-            if (!raw && !succ_eq)
-                break;
-            run_length++;
-        }
-        curpix += run_length;
-        out.put(raw ? run_length-1 : run_length+127);
-        if (!out.good()) return false;
-        out.write(reinterpret_cast<const char *>(data.data()+chunkstart), (raw?run_length*bpp:bpp));
-        if (!out.good()) return false;
-    }
-    return true;
+bool TGAImage::unload_rle_data(std::ostream &out) const {
+    return write_rle_rows(out, data.data(), w, h, size_t(w)*bpp, bpp);
 }
 
 TGAColor TGAImage::get(const int x, const int y) const {
     if (!data.size() || x<0 || y<0 || x>=w || y>=h) return {};
     TGAColor ret = {0, 0, 0, 0, bpp};
-    const std::uint8_t *p = data.data()+(x+y*w)*bpp;
+    const std::uint8_t *p = data.data()+(x+size_t(y)*w)*bpp;
     for (int i=bpp; i--; ret.bgra[i] = p[i]);
     return ret;
 }
 
 void TGAImage::set(int x, int y, const TGAColor &c) {
     if (!data.size() || x<0 || y<0 || x>=w || y>=h) return;
-    memcpy(data.data()+(x+y*w)*bpp, c.bgra, bpp);
+    memcpy(data.data()+(x+size_t(y)*w)*bpp, c.bgra, bpp);
 }
 
 void TGAImage::flip_horizontally() {
     for (int i=0; i<w/2; i++)
         for (int j=0; j<h; j++)
             for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(w-1-i+j*w)*bpp+b]);
+                std::swap(data[(i+size_t(j)*w)*bpp+b], data[(w-1-i+size_t(j)*w)*bpp+b]);
 }
 
 void TGAImage::flip_vertically() {
+    PROFILE_SCOPE("flip");
     for (int i=0; i<w; i++)
         for (int j=0; j<h/2; j++)
             for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(i+(h-1-j)*w)*bpp+b]);
+                std::swap(data[(i+size_t(j)*w)*bpp+b], data[(i+size_t(h-1-j)*w)*bpp+b]);
 }
 
 int TGAImage::width() const {
@@ -200,3 +235,122 @@ int TGAImage::height() const {
     return h;
 }
 
+int TGAImage::bytespp() const {
+    return bpp;
+}
+
+bool TGAWriter::open(const std::string &filename, int width, int height, int bytespp, bool use_rle) {
+    if (width<=0 || height<=0 || width>TGA_MAX_SIZE || height>TGA_MAX_SIZE ||
+        (bytespp!=TGAImage::GRAYSCALE && bytespp!=TGAImage::RGB && bytespp!=TGAImage::RGBA)) {
+        std::cerr << "bad tga size " << width << "x" << height << "/" << bytespp*8 << "\n";
+        return false;
+    }
+    w = width;
+    h = height;
+    bpp = bytespp;
+    rle = use_rle;
+    y = 0;
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    TGAHeader header = {};
+    header.bitsperpixel = bpp<<3;
+    header.width  = w;
+    header.height = h;
+    header.datatypecode = (bpp==TGAImage::GRAYSCALE ? (rle?11:3) : (rle?10:2));
+    header.imagedescriptor = 0x20;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    return out.good();
+}
+
+bool TGAWriter::write_rows(const std::uint8_t *p, int nrows, size_t stride) {
+    PROFILE_SCOPE("tga_encode");
+    if (!out.is_open() || y+nrows>h) return false;
+    if (rle) {
+        if (!write_rle_rows(out, p, w, nrows, stride, bpp)) return false;
+    } else {
+        for (int r=0; r<nrows; r++, p+=stride) out.write(reinterpret_cast<const char *>(p), size_t(w)*bpp);
+        if (!out.good()) return false;
+    }
+    y += nrows;
+    return true;
+}
+
+bool TGAWriter::close() {
+    if (!out.is_open()) return false;
+    bool ok = y==h && write_footer(out);
+    out.close();
+    if (y!=h) std::cerr << "tga closed after " << y << " of " << h << " rows\n";
+    return ok && !out.fail();
+}
+
+bool TiledTGAWriter::open(const std::string &filename, int width, int height, int bytespp, bool use_rle) {
+    w = width;
+    h = height;
+    bpp = bytespp;
+    rle = use_rle;
+    y = 0;
+    names.clear();
+    writers.clear();
+    if (w<=0 || h<=0) return false;
+    cols = (w + TGA_MAX_SIZE - 1)/TGA_MAX_SIZE;
+    int rows = (h + TGA_MAX_SIZE - 1)/TGA_MAX_SIZE;
+    if (cols==1 && rows==1) {
+        names.push_back(filename);
+        return open_row(0);
+    }
+
+    std::string stem = filename;
+    if (stem.size()>4 && stem.compare(stem.size()-4, 4, ".tga")==0) stem.resize(stem.size()-4);
+    std::ofstream manifest(stem + ".tiles");
+    manifest << w << " " << h << "\n";
+    for (int r=0; r<rows; r++) {
+        for (int c=0; c<cols; c++) {
+            names.push_back(stem + "_" + std::to_string(r) + "_" + std::to_string(c) + ".tga");
+            manifest << c*TGA_MAX_SIZE << " " << r*TGA_MAX_SIZE << " "
+                     << std::min(TGA_MAX_SIZE, w - c*TGA_MAX_SIZE) << " " << std::min(TGA_MAX_SIZE, h - r*TGA_MAX_SIZE) << " "
+                     << names.back() << "\n";
+        }
+    }
+    if (!manifest.good()) {
+        std::cerr << "can't write " << stem << ".tiles\n";
+        return false;
+    }
+    return open_row(0);
+}
+
+bool TiledTGAWriter::open_row(int row) {
+    writers = std::vector<TGAWriter>(cols);
+    int th = std::min(TGA_MAX_SIZE, h - row*TGA_MAX_SIZE);
+    for (int c=0; c<cols; c++)
+        if (!writers[c].open(names[row*cols + c], std::min(TGA_MAX_SIZE, w - c*TGA_MAX_SIZE), th, bpp, rle)) return false;
+    return true;
+}
+
+bool TiledTGAWriter::write_rows(const std::uint8_t *p, int nrows, size_t stride) {
+    if (writers.empty() || y+nrows>h) return false;
+    while (nrows>0) {
+        // 一批行可能跨过块的下边界，分两段写
+        int n = std::min(nrows, TGA_MAX_SIZE - y%TGA_MAX_SIZE);
+        for (int c=0; c<cols; c++)
+            if (!writers[c].write_rows(p + size_t(c)*TGA_MAX_SIZE*bpp, n, stride)) return false;
+        y += n;
+        p += stride*n;
+        nrows -= n;
+        if (y%TGA_MAX_SIZE==0 && y<h) {
+            for (TGAWriter &wr : writers)
+                if (!wr.close()) return false;
+            if (!open_row(y/TGA_MAX_SIZE)) return false;
+        }
+    }
+    return true;
+}
+
+bool TiledTGAWriter::close() {
+    bool ok = !writers.empty() && y==h;
+    for (TGAWriter &wr : writers) ok = wr.close() && ok;
+    writers.clear();
+    return ok;
+}
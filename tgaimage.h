@@ -1,7 +1,9 @@
 #pragma once
 #include <cstdint>
 #include <fstream>
+#include <string>
 #include <vector>
+#include "color.h"
 
 #pragma pack(push,1)
 struct TGAHeader {
@@ -20,15 +22,19 @@ struct TGAHeader {
 };
 #pragma pack(pop)
 
+// 文件头里宽高是 16 位，单个 TGA 文件的边长上限
+constexpr int TGA_MAX_SIZE = 65535;
+
 struct TGAColor {
     std::uint8_t bgra[4] = {0,0,0,0};
     std::uint8_t bytespp = 4;
     std::uint8_t& operator[](const int i) { return bgra[i]; }
 
+    // 各通道乘以截断到 [0, 1] 的 intensity，按 32 位字做定点运算，见 color.h
     TGAColor operator *(float intensity) const {
         TGAColor res = *this;
-        intensity = (intensity>1.f?1.f:(intensity<0.f?0.f:intensity));
-        for (int i=0; i<4; i++) res.bgra[i] = bgra[i]*intensity;
+        std::uint32_t c = color_scale(bgra[0] | bgra[1] << 8 | bgra[2] << 16 | std::uint32_t(bgra[3]) << 24, color_weight(intensity));
+        for (int i=0; i<4; i++) res.bgra[i] = c >> 8*i;
         return res;
     }
 };
@@ -39,17 +45,67 @@ struct TGAImage {
     TGAImage(const int w, const int h, const int bpp);
     bool  read_tga_file(const std::string filename);
     bool write_tga_file(const std::string filename, const bool vflip=true, const bool rle=true) const;
+    // 从流中读写一个完整的 TGA，供把图像嵌入其它容器（如 sequence.h）；读取不消耗文件尾
+    bool  read_tga(std::istream &in);
+    bool write_tga(std::ostream &out, const bool vflip=true, const bool rle=true) const;
     void flip_horizontally();
     void flip_vertically();
     TGAColor get(const int x, const int y) const;
     void set(const int x, const int y, const TGAColor &c);
+    // 直接写入打包颜色（color.h）的低 bytespp 个字节，不经过 TGAColor；越界时忽略
+    void set_packed(const int x, const int y, const std::uint32_t c) {
+        if (x<0 || y<0 || x>=w || y>=h) return;
+        std::uint8_t *p = data.data() + (x + size_t(y)*w)*bpp;
+        for (int i=0; i<bpp; i++) p[i] = c >> 8*i;
+    }
     int width()  const;
     int height() const;
+    int bytespp() const;
+    const std::uint8_t *buffer() const { return data.data(); }   // 按行从上到下紧密排列
+    std::uint8_t *buffer() { return data.data(); }
 private:
-    bool   load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out) const;
+    bool   load_rle_data(std::istream &in);
+    bool unload_rle_data(std::ostream &out) const;
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
     std::vector<std::uint8_t> data = {};
 };
 
+// TGA 的 RLE 数据包：npixels 个各 bpp 字节的连续像素，数据包最长 128 个像素
+bool write_rle(std::ostream &out, const std::uint8_t *data, size_t npixels, int bpp);
+// 解码恰好 npixels 个像素；数据截断或数据包越过 npixels 时返回 false
+bool read_rle(std::istream &in, std::uint8_t *data, size_t npixels, int bpp);
+
+// 增量 TGA 编码器：先写文件头（左上角为原点），之后按从上到下的顺序分批追加行，内存只需容纳一批
+// RLE 逐行编码，数据包不跨行；一批内的行在线程池里并行编码
+class TGAWriter {
+public:
+    bool open(const std::string &filename, int w, int h, int bpp, bool rle=true);
+    // 追加 nrows 行，每行 w*bpp 字节，相邻两行起点相距 stride 字节
+    bool write_rows(const std::uint8_t *p, int nrows, size_t stride);
+    // 写入文件尾；写入的行数不足 h 时返回 false
+    bool close();
+    int rows_written() const { return y; }
+private:
+    std::ofstream out;
+    int w = 0, h = 0, bpp = 0, y = 0;
+    bool rle = true;
+};
+
+// 任意尺寸的增量写出：不超过 TGA_MAX_SIZE 时就是单个文件 filename；
+// 否则按 TGA_MAX_SIZE 切成网格，每块一个 <stem>_<行>_<列>.tga，并写一个文本清单 <stem>.tiles：
+// 首行为整幅图像的宽高，之后每行一块 "x y w h 文件名"；同一时间只打开一行块
+class TiledTGAWriter {
+public:
+    bool open(const std::string &filename, int w, int h, int bpp, bool rle=true);
+    bool write_rows(const std::uint8_t *p, int nrows, size_t stride);
+    bool close();
+    const std::vector<std::string> &files() const { return names; }
+private:
+    int w = 0, h = 0, bpp = 0, y = 0, cols = 0;
+    bool rle = true;
+    std::vector<std::string> names;     // 按行优先排列
+    std::vector<TGAWriter> writers;     // 当前一行块
+
+    bool open_row(int row);
+};